@@ -1,10 +1,25 @@
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
 #include <vector>
 
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 // problem: given a list of integers, we want to extract a sublist that is:
 // - strictly increasing;
 // - of maximum length.
@@ -256,6 +271,173 @@ class IncreasingSubsetExtractor {
     }
 };
 
+// a versioned variant of the above extractor: each call to feed() creates
+// a new version, and the longest increasing subset can be queried at any
+// past version without replaying the input.
+//
+// instead of the candidate subsets, we only keep, for each length l, the
+// element that ends an increasing subset of length l with the smallest value
+// (the "tails"), and for each element the element before it in its subset.
+// feeding a value changes a single entry of the tails, so the tails are
+// stored in a persistent binary tree: a new version copies the nodes on the
+// path to the changed entry and shares all the others with the previous
+// version. this is O(log(n)) time and memory per feed().
+class PersistentIncreasingSubsetExtractor {
+  private:
+    struct Node {
+        int left = -1;
+        int right = -1;
+        int last = -1; // element stored at the rightmost non-empty position
+    };
+
+    struct Version {
+        int root = -1;
+        int height = 0; // the tree covers positions [0, 2^height)
+        size_t length = 0;
+    };
+
+    std::vector<int> m_numbers;
+    std::vector<int> m_previous; // previous element in the subset, or -1
+    std::vector<Node> m_nodes;
+    std::vector<Version> m_versions{Version{}};
+
+    // returns the element at position 'pos' in the tails of 'version'
+    int get(const Version& version, size_t pos) const {
+        int node = version.root;
+        for (int h = version.height; h > 0; --h) {
+            const size_t half = size_t(1) << (h - 1);
+            if (pos < half) {
+                node = m_nodes[node].left;
+            } else {
+                node = m_nodes[node].right;
+                pos -= half;
+            }
+        }
+        return m_nodes[node].last;
+    }
+
+    // returns a copy of 'node' where position 'pos' stores 'element'
+    int set(int node, int height, size_t pos, int element) {
+        Node copy = node == -1 ? Node{} : m_nodes[node];
+
+        if (height > 0) {
+            const size_t half = size_t(1) << (height - 1);
+            if (pos < half) {
+                copy.left = set(copy.left, height - 1, pos, element);
+            } else {
+                copy.right = set(copy.right, height - 1, pos - half, element);
+            }
+            copy.last = copy.right != -1 ? m_nodes[copy.right].last
+                                         : m_nodes[copy.left].last;
+        } else {
+            copy.last = element;
+        }
+
+        m_nodes.push_back(copy);
+        return static_cast<int>(m_nodes.size() - 1);
+    }
+
+    // returns the first position in the tails of 'version' whose value is
+    // greater than or equal to 'value'.
+    // the tails are increasing so we can use the rightmost value of the left
+    // subtree to choose the side.
+    size_t lower_bound(const Version& version, int value) const {
+        if (version.length == 0 ||
+            m_numbers[m_nodes[version.root].last] < value)
+            return version.length;
+
+        int node = version.root;
+        size_t pos = 0;
+        for (int h = version.height; h > 0; --h) {
+            const int left = m_nodes[node].left;
+            if (m_numbers[m_nodes[left].last] >= value) {
+                node = left;
+            } else {
+                node = m_nodes[node].right;
+                pos += size_t(1) << (h - 1);
+            }
+        }
+        return pos;
+    }
+
+  public:
+    // appends a new value to the list of input numbers and creates a new
+    // version.
+    void feed(int n) {
+        const int element = static_cast<int>(m_numbers.size());
+        m_numbers.push_back(n);
+
+        Version version = m_versions.back();
+        const size_t pos = lower_bound(version, n);
+        m_previous.push_back(pos == 0 ? -1 : get(version, pos - 1));
+
+        if (pos == version.length) {
+            // grow the tree when it is full; the old root becomes the left
+            // child of the new one
+            if (version.length == (size_t(1) << version.height) &&
+                version.root != -1) {
+                Node root;
+                root.left = version.root;
+                root.last = m_nodes[version.root].last;
+                m_nodes.push_back(root);
+                version.root = static_cast<int>(m_nodes.size() - 1);
+                ++version.height;
+            }
+            ++version.length;
+        }
+
+        version.root = set(version.root, version.height, pos, element);
+        m_versions.push_back(version);
+    }
+
+    template <typename It> void feed(It begin, It end) {
+        while (begin != end) {
+            feed(*(begin++));
+        }
+    }
+
+    void feed(const std::vector<int>& numbers) {
+        feed(numbers.begin(), numbers.end());
+    }
+
+    // version 'v' is the state after the first 'v' numbers were fed;
+    // version 0 is the empty state.
+    size_t version() const { return m_versions.size() - 1; }
+
+    const std::vector<int>& numbers() const { return m_numbers; }
+
+    size_t longest_increasing_subset_length(size_t v) const {
+        return m_versions.at(v).length;
+    }
+
+    size_t longest_increasing_subset_length() const {
+        return m_versions.back().length;
+    }
+
+    // the last element is found in O(log(n)), the rest of the subset is
+    // obtained by following the links to the previous elements.
+    std::vector<int> longest_increasing_subset(size_t v) const {
+        const Version& version = m_versions.at(v);
+        std::vector<int> subset(version.length);
+        if (version.length == 0) return subset;
+
+        int element = get(version, version.length - 1);
+        for (size_t i = version.length; i > 0; --i) {
+            subset[i - 1] = m_numbers[element];
+            element = m_previous[element];
+        }
+
+        return subset;
+    }
+
+    std::vector<int> longest_increasing_subset() const {
+        return longest_increasing_subset(version());
+    }
+
+    // number of tree nodes allocated, for all versions
+    size_t node_count() const { return m_nodes.size(); }
+};
+
 namespace v1 {
 std::vector<std::vector<int>>
 build_lis_candidates(std::vector<int>::const_iterator begin,
@@ -309,6 +491,1117 @@ int longest_increasing_subset_length(
     return longest_increasing_subset(numbers, build_candidates).size();
 }
 
+// variant of the problem for noisy inputs: we want the longest subset that
+// is strictly increasing, except for at most 'k' "bad steps" where an element
+// is less than or equal to the previous one.
+//
+// example:
+// with the list [1, 2, 0, 3, 4] and k = 1
+// the whole list is a solution, with a single bad step (2 -> 0).
+
+// recursively compute the length of the longest subset of [begin, end) with
+// at most 'k' bad steps, by trying all possibilities.
+// 'prev' is the last value of the subset currently being built, if any.
+size_t compute_length_of_longest_robust_subset(
+    std::vector<int>::const_iterator begin,
+    std::vector<int>::const_iterator end, const int* prev, size_t k) {
+    if (begin == end) return 0;
+
+    size_t without_val =
+        compute_length_of_longest_robust_subset(std::next(begin), end, prev, k);
+
+    bool bad_step = prev && *begin <= *prev;
+    if (bad_step && k == 0) return without_val;
+
+    size_t with_val = 1 + compute_length_of_longest_robust_subset(
+                              std::next(begin), end, &*begin,
+                              bad_step ? k - 1 : k);
+    return std::max(with_val, without_val);
+}
+
+size_t compute_length_of_longest_robust_subset(const std::vector<int>& numbers,
+                                               size_t k) {
+    return compute_length_of_longest_robust_subset(
+        numbers.begin(), numbers.end(), nullptr, k);
+}
+
+struct RobustIncreasingSubset {
+    std::vector<int> values;
+    std::vector<size_t> indices; // positions of 'values' in the input
+    // positions p in 'values' such that values[p] <= values[p - 1]
+    std::vector<size_t> violations;
+};
+
+// computes the longest subset with at most 'k' bad steps in O(n.k.log(n)).
+//
+// let f(i, v) be the length of the longest subset ending with the i-th
+// number and having at most v bad steps. the last step to i is either:
+// - a good step, from a smaller number j with f(j, v);
+// - a bad step, from any number j with f(j, v - 1).
+// so f(i, v) = 1 + max(max{f(j, v) | j < i, a[j] < a[i]},
+//                      max{f(j, v - 1) | j < i}).
+// the first term is a prefix maximum over the values less than a[i]: it is
+// answered by a Fenwick tree indexed by the rank of the values. the second
+// term is a running maximum.
+//
+// there is one such "layer" per v in [0, k], and all layers are queried and
+// updated at the same rank for a given number. the k + 1 layers are therefore
+// interleaved in a single tree so that each node stores k + 1 consecutive
+// lengths; the inner loops over layers are then branch-free and contiguous,
+// which lets the compiler vectorize them.
+RobustIncreasingSubset
+longest_robust_increasing_subset(const std::vector<int>& numbers, size_t k) {
+    const size_t n = numbers.size();
+
+    RobustIncreasingSubset result;
+    if (n == 0) return result;
+
+    // a subset has at most n - 1 steps, more layers would be useless
+    k = std::min(k, n - 1);
+    const size_t layers = k + 1;
+
+    // 1-based ranks, equal values having the same rank
+    std::vector<int> sorted = numbers;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    const size_t nb_ranks = sorted.size();
+
+    // node r of the tree covers the ranks (r - lowbit(r), r]
+    std::vector<unsigned> tree_length((nb_ranks + 1) * layers, 0);
+    std::vector<unsigned> tree_index((nb_ranks + 1) * layers, 0);
+
+    // best subset so far in each layer, regardless of its last value
+    std::vector<unsigned> running_length(layers, 0);
+    std::vector<unsigned> running_index(layers, 0);
+
+    // f(i, v), the (1-based) index of the previous element, 0 if none, and
+    // whether the step from the previous element is counted as a bad step
+    std::vector<unsigned> length(n * layers);
+    std::vector<unsigned> parent(n * layers);
+    std::vector<unsigned char> bad_step(n * layers);
+
+    std::vector<unsigned> best_length(layers);
+    std::vector<unsigned> best_index(layers);
+
+    for (size_t i = 0; i < n; ++i) {
+        const size_t rank =
+            std::lower_bound(sorted.begin(), sorted.end(), numbers[i]) -
+            sorted.begin() + 1;
+
+        // good steps: prefix maximum over the ranks strictly less than 'rank'
+        std::fill(best_length.begin(), best_length.end(), 0);
+        std::fill(best_index.begin(), best_index.end(), 0);
+
+        for (size_t r = rank - 1; r > 0; r -= r & (~r + 1)) {
+            const unsigned* node_length = &tree_length[r * layers];
+            const unsigned* node_index = &tree_index[r * layers];
+            for (size_t v = 0; v < layers; ++v) {
+                bool better = node_length[v] > best_length[v];
+                best_length[v] = better ? node_length[v] : best_length[v];
+                best_index[v] = better ? node_index[v] : best_index[v];
+            }
+        }
+
+        // bad steps: best of the previous layer
+        unsigned* f = &length[i * layers];
+        unsigned* p = &parent[i * layers];
+        unsigned char* b = &bad_step[i * layers];
+
+        for (size_t v = 0; v < layers; ++v) {
+            unsigned from_bad = v > 0 ? running_length[v - 1] : 0;
+            bool bad = from_bad > best_length[v];
+            f[v] = 1 + (bad ? from_bad : best_length[v]);
+            p[v] = bad ? running_index[v - 1] : best_index[v];
+            b[v] = bad;
+        }
+
+        const unsigned self = static_cast<unsigned>(i + 1);
+
+        for (size_t r = rank; r <= nb_ranks; r += r & (~r + 1)) {
+            unsigned* node_length = &tree_length[r * layers];
+            unsigned* node_index = &tree_index[r * layers];
+            for (size_t v = 0; v < layers; ++v) {
+                bool better = f[v] > node_length[v];
+                node_length[v] = better ? f[v] : node_length[v];
+                node_index[v] = better ? self : node_index[v];
+            }
+        }
+
+        for (size_t v = 0; v < layers; ++v) {
+            bool better = f[v] > running_length[v];
+            running_length[v] = better ? f[v] : running_length[v];
+            running_index[v] = better ? self : running_index[v];
+        }
+    }
+
+    // walk back from the end of the best subset with at most k bad steps.
+    // when going back through a bad step, the previous element is searched
+    // in the previous layer.
+    size_t i = running_index[k] - 1;
+    size_t v = k;
+
+    for (;;) {
+        result.indices.push_back(i);
+        unsigned prev = parent[i * layers + v];
+        if (prev == 0) break;
+        if (bad_step[i * layers + v]) --v;
+        i = prev - 1;
+    }
+
+    std::reverse(result.indices.begin(), result.indices.end());
+
+    for (size_t p = 0; p < result.indices.size(); ++p) {
+        result.values.push_back(numbers[result.indices[p]]);
+        if (p > 0 && result.values[p] <= result.values[p - 1])
+            result.violations.push_back(p);
+    }
+
+    return result;
+}
+
+// variant of the problem for periodic inputs: we want the longest increasing
+// subset over all the rotations of the input.
+//
+// example:
+// with the list [3, 4, 1, 2]
+// the longest increasing subset has length 2, but the rotation [1, 2, 3, 4]
+// is itself increasing, so the answer is 4.
+//
+// the rotations of a list of n numbers are the windows of length n of the
+// list concatenated with itself. we use Tiskin's "seaweed" (or sticky braid)
+// technique which computes, in O(n.log^2(n)), a representation of the
+// lengths of the longest increasing subsets of *all* the windows of a list.
+//
+// the idea: the longest increasing subset of a window of a list is its longest
+// common subsequence with the sorted list of distinct values. in the
+// alignment grid of these two sequences (one row per value, one column per
+// element of the list), "seaweeds" enter from the left and top borders and
+// travel towards the bottom-right, two seaweeds crossing at most once and never
+// in a cell where the row and the column match. the length for a window
+// [i, j) is then (j - i) minus the number of seaweeds entering from the top in
+// [i, j) and leaving from the bottom before j.
+namespace seaweed {
+
+// a braid is a permutation, giving for each seaweed entering the grid the
+// position where it leaves it. entry positions are the left border, from
+// bottom to top, followed by the top border, from left to right; exit positions
+// are the bottom border, from left to right, followed by the right border,
+// from bottom to top.
+using Braid = std::vector<int>;
+
+// computes 'c' such that the braid c is braid 'a' followed by braid 'b',
+// where seaweeds that would cross twice do not cross at all.
+// this is the "steady ant" algorithm, in O(n.log(n)): the inner dimension
+// is split in halves, the two halves are multiplied recursively and the
+// results are merged by walking along the boundary between the regions where
+// each half dominates.
+// 'work' must have room for 11 * n + 64 ints.
+void multiply(const int* a, const int* b, int* c, int n, int* work) {
+    if (n <= 1) {
+        if (n == 1) c[0] = 0;
+        return;
+    }
+
+    const int mid = n / 2;
+    const int n_lo = mid;
+    const int n_hi = n - mid;
+
+    int* rows_lo = work;
+    int* rows_hi = rows_lo + n_lo;
+    int* a_lo = rows_hi + n_hi;
+    int* a_hi = a_lo + n_lo;
+    int* b_lo = a_hi + n_hi;
+    int* b_hi = b_lo + n_lo;
+    int* cols_lo = b_hi + n_hi;
+    int* cols_hi = cols_lo + n_lo;
+    int* c_lo = cols_hi + n_hi;
+    int* c_hi = c_lo + n_lo;
+    int* next = c_hi + n_hi;
+
+    // the lower half: points of 'a' whose column is < mid, and points
+    // of 'b' whose row is < mid; with rows and columns renumbered.
+    for (int r = 0, lo = 0, hi = 0; r < n; ++r) {
+        if (a[r] < mid) {
+            rows_lo[lo] = r;
+            a_lo[lo++] = a[r];
+        } else {
+            rows_hi[hi] = r;
+            a_hi[hi++] = a[r] - mid;
+        }
+    }
+
+    int* col_rank = c; // 'c' is used as a temporary
+    for (int r = 0; r < n; ++r)
+        col_rank[b[r]] = r < mid ? 0 : 1;
+    for (int col = 0, lo = 0, hi = 0; col < n; ++col) {
+        if (col_rank[col] == 0) {
+            col_rank[col] = lo;
+            cols_lo[lo++] = col;
+        } else {
+            col_rank[col] = hi;
+            cols_hi[hi++] = col;
+        }
+    }
+    for (int r = 0; r < n; ++r)
+        (r < mid ? b_lo[r] : b_hi[r - mid]) = col_rank[b[r]];
+
+    multiply(a_lo, b_lo, c_lo, n_lo, next);
+    multiply(a_hi, b_hi, c_hi, n_hi, next);
+
+    // the union of both halves is a permutation; 'a_lo' to 'b_hi' are
+    // reused to store it.
+    int* col_of_row = a_lo;
+    int* row_of_col = b_lo;
+    int* is_hi = next;
+    int* t = is_hi + n;
+    int* t_hi = t + n + 1;
+    int* t_lo = t_hi + n + 1;
+
+    for (int x = 0; x < n_lo; ++x) {
+        col_of_row[rows_lo[x]] = cols_lo[c_lo[x]];
+        row_of_col[cols_lo[c_lo[x]]] = rows_lo[x];
+        is_hi[rows_lo[x]] = 0;
+    }
+    for (int x = 0; x < n_hi; ++x) {
+        col_of_row[rows_hi[x]] = cols_hi[c_hi[x]];
+        row_of_col[cols_hi[c_hi[x]]] = rows_hi[x];
+        is_hi[rows_hi[x]] = 1;
+    }
+
+    // with d_hi(i, k) the number of points of the upper half above row i and
+    // left of column k, and d_lo(i, k) the number of points of the lower half
+    // below row i and right of column k, the result keeps the points of the
+    // lower half where d_hi < d_lo, and those of the upper half where
+    // d_hi >= d_lo. since d_hi - d_lo is non-decreasing in both i and k, the
+    // boundary between the two regions is a staircase, described by t[k], the
+    // first row where d_hi >= d_lo in column k.
+    int i = n;
+    int d_hi = 0;
+    int d_lo = 0;
+
+    for (int k = 0; k <= n; ++k) {
+        if (k > 0) {
+            const int r = row_of_col[k - 1];
+            if (is_hi[r])
+                d_hi += r < i;
+            else
+                d_lo -= r >= i;
+        }
+
+        while (i > 0) {
+            const int r = i - 1;
+            const int up_hi = d_hi - (is_hi[r] && col_of_row[r] < k);
+            const int up_lo = d_lo + (!is_hi[r] && col_of_row[r] >= k);
+            if (up_hi < up_lo) break;
+            d_hi = up_hi;
+            d_lo = up_lo;
+            --i;
+        }
+
+        t[k] = i;
+        t_hi[k] = d_hi;
+        t_lo[k] = d_lo;
+    }
+
+    // points whose cell lies entirely on one side of the staircase
+    for (int r = 0; r < n; ++r) {
+        const int col = col_of_row[r];
+        const bool keep = is_hi[r] ? r >= t[col] : r + 1 < t[col + 1];
+        c[r] = keep ? col : -1;
+    }
+
+    // cells crossed by the staircase: the density of the result is computed
+    // from min(d_hi, d_lo) at the four corners of the cell.
+    for (int k = 0; k < n; ++k) {
+        const int top = std::max(t[k + 1] - 1, 0);
+        const int bottom = t[k];
+        if (top >= bottom) continue;
+
+        const int r_k = row_of_col[k];
+        int h = t_hi[k];
+        int l = t_lo[k];
+        int below_left = 0;
+        int below_right = 0;
+
+        for (int row = bottom;; --row) {
+            const int left = std::min(h, l);
+            const int right = std::min(h + (is_hi[r_k] && r_k < row),
+                                       l - (!is_hi[r_k] && r_k >= row));
+
+            if (row < bottom) {
+                const int density = (col_of_row[row] == k) + right - left -
+                                    below_right + below_left;
+                if (density == 1) c[row] = k;
+            }
+
+            if (row == top) break;
+
+            below_left = left;
+            below_right = right;
+            const int r = row - 1;
+            h -= is_hi[r] && col_of_row[r] < k;
+            l += !is_hi[r] && col_of_row[r] >= k;
+        }
+    }
+}
+
+Braid multiply(const Braid& a, const Braid& b) {
+    const int n = static_cast<int>(a.size());
+    Braid c(n);
+    std::vector<int> work(11 * static_cast<size_t>(n) + 64);
+    multiply(a.data(), b.data(), c.data(), n, work.data());
+    return c;
+}
+
+// computes the braid of the grid made of the rows [lo, hi) (values, by rank)
+// and of the columns 'cols' (positions of the elements whose rank is in
+// [lo, hi)).
+// the other columns have no match in these rows: their seaweed goes straight
+// down, without disturbing the others, so they can be left out.
+Braid build_braid(const std::vector<int>& ranks, int lo, int hi,
+                  const std::vector<int>& cols) {
+    const int m = hi - lo;
+    const int k = static_cast<int>(cols.size());
+
+    // a single row, that matches all the columns: no seaweeds cross.
+    if (m == 1) {
+        Braid braid(1 + k);
+        std::iota(braid.begin(), braid.end(), 0);
+        return braid;
+    }
+
+    // split the rows in two strips, compute their braids...
+    const int mid = lo + m / 2;
+    std::vector<int> cols_top, cols_bottom;
+    std::vector<int> index_top, index_bottom;
+
+    for (int j = 0; j < k; ++j) {
+        if (ranks[cols[j]] < mid) {
+            cols_top.push_back(cols[j]);
+            index_top.push_back(j);
+        } else {
+            cols_bottom.push_back(cols[j]);
+            index_bottom.push_back(j);
+        }
+    }
+
+    const Braid top = build_braid(ranks, lo, mid, cols_top);
+    const Braid bottom = build_braid(ranks, mid, hi, cols_bottom);
+
+    // ... put back the columns that were left out ...
+    auto expand = [k](const Braid& strip, int rows,
+                      const std::vector<int>& index) {
+        const int strip_cols = static_cast<int>(index.size());
+        Braid braid(rows + k);
+        for (int q = 0; q < k; ++q)
+            braid[rows + q] = q;
+        for (int x = 0; x < rows + strip_cols; ++x) {
+            const int y = strip[x];
+            braid[x < rows ? x : rows + index[x - rows]] =
+                y < strip_cols ? index[y] : k + (y - strip_cols);
+        }
+        return braid;
+    };
+
+    const int m_top = mid - lo;
+    const int m_bottom = hi - mid;
+    const Braid expanded_top = expand(top, m_top, index_top);
+    const Braid expanded_bottom = expand(bottom, m_bottom, index_bottom);
+
+    // ... and stack them: seaweeds first go through the top strip, and
+    // those leaving it from the bottom then go through the bottom strip.
+    Braid first(m + k), second(m + k);
+    for (int x = 0; x < m_bottom; ++x)
+        first[x] = x;
+    for (int x = 0; x < m_top + k; ++x)
+        first[m_bottom + x] = m_bottom + expanded_top[x];
+    for (int x = 0; x < m_bottom + k; ++x)
+        second[x] = expanded_bottom[x];
+    for (int x = m_bottom + k; x < m + k; ++x)
+        second[x] = x;
+
+    return multiply(first, second);
+}
+
+} // namespace seaweed
+
+struct CyclicIncreasingSubsetLength {
+    size_t length = 0;   // maximum over all rotations
+    size_t rotation = 0; // index of the first element of the best rotation
+    std::vector<size_t> lengths; // per rotation, if requested
+};
+
+// computes the length of the longest increasing subset over all the rotations
+// of 'numbers', and optionally the length for each rotation.
+CyclicIncreasingSubsetLength
+cyclic_longest_increasing_subset_length(const std::vector<int>& numbers,
+                                        bool per_rotation = false) {
+    CyclicIncreasingSubsetLength result;
+    const int n = static_cast<int>(numbers.size());
+    if (n == 0) return result;
+
+    std::vector<int> values = numbers;
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    const int m = static_cast<int>(values.size());
+
+    // the list concatenated with itself, as ranks
+    std::vector<int> ranks(2 * n);
+    for (int j = 0; j < n; ++j) {
+        ranks[j] = ranks[j + n] = static_cast<int>(
+            std::lower_bound(values.begin(), values.end(), numbers[j]) -
+            values.begin());
+    }
+
+    std::vector<int> cols(2 * n);
+    std::iota(cols.begin(), cols.end(), 0);
+    const seaweed::Braid braid = seaweed::build_braid(ranks, 0, m, cols);
+
+    // the rotation starting at s is the window [s, s + n); its length is n
+    // minus the number of seaweeds entering from the top at x >= s and
+    // leaving from the bottom at y < s + n. these are counted with a Fenwick
+    // tree over y, adding seaweeds by decreasing x.
+    std::vector<int> fenwick(2 * n + 1, 0);
+
+    if (per_rotation) result.lengths.resize(n);
+
+    for (int s = 2 * n - 1; s >= 0; --s) {
+        const int y = braid[m + s];
+        if (y < 2 * n) {
+            for (int node = y + 1; node <= 2 * n; node += node & -node)
+                ++fenwick[node];
+        }
+
+        if (s >= n) continue;
+
+        int count = 0;
+        for (int node = s + n; node > 0; node -= node & -node)
+            count += fenwick[node];
+
+        const size_t length = static_cast<size_t>(n - count);
+        if (per_rotation) result.lengths[s] = length;
+        if (length >= result.length) {
+            result.length = length;
+            result.rotation = static_cast<size_t>(s);
+        }
+    }
+
+    return result;
+}
+
+// variant of the problem for inputs too large for a single process: the
+// input is split in contiguous shards, each held by a worker process, and
+// the coordinator only exchanges O(L) numbers with each worker, where L is
+// the length of the longest increasing subset.
+//
+// the state passed from one shard to the next is the "tails" of patience
+// sorting: tails[j] is the smallest value ending an increasing subset of
+// length j + 1 of the input so far. each worker receives the tails of the
+// previous shards, continues patience sorting on its shard while
+// remembering, for each of its numbers, the position of the previous number
+// of the best subset ending with it, and sends the updated tails back.
+// the coordinator then walks the subset back from its last number, asking
+// each worker for its part.
+//
+// the shards are processed one after the other, in O(n.log(L)) overall as
+// in a single process: more processes spread the input and the memory of
+// the computation, but do not make it faster.
+namespace sharded {
+
+constexpr uint64_t none = std::numeric_limits<uint64_t>::max();
+
+// the state passed from shard to shard: the smallest value ending an
+// increasing subset of each length, and its position in the input
+struct Tails {
+    std::vector<int> values;
+    std::vector<uint64_t> positions;
+};
+
+// the part of the input held by a worker
+class Shard {
+  private:
+    std::vector<int> m_numbers;
+    uint64_t m_offset = 0; // position of the shard in the input
+    // position of the previous number of the best subset ending with each
+    // number, possibly in a previous shard; 'none' if there is none
+    std::vector<uint64_t> m_previous;
+
+  public:
+    Shard(std::vector<int> numbers, uint64_t offset)
+        : m_numbers(std::move(numbers)), m_offset(offset) {}
+
+    // continues patience sorting on the shard, after the previous shards
+    void extend(Tails& tails) {
+        m_previous.resize(m_numbers.size());
+        for (size_t i = 0; i < m_numbers.size(); ++i) {
+            const size_t j = std::lower_bound(tails.values.begin(),
+                                              tails.values.end(),
+                                              m_numbers[i]) -
+                             tails.values.begin();
+            m_previous[i] = j == 0 ? none : tails.positions[j - 1];
+            if (j == tails.values.size()) {
+                tails.values.push_back(m_numbers[i]);
+                tails.positions.push_back(m_offset + i);
+            } else {
+                tails.values[j] = m_numbers[i];
+                tails.positions[j] = m_offset + i;
+            }
+        }
+    }
+
+    // appends to 'part' the numbers of the shard in the subset ending at
+    // position 'last', and returns the position of the number before them
+    // (in a previous shard), or 'none'.
+    uint64_t backtrack(uint64_t last, RobustIncreasingSubset& part) const {
+        if (last < m_offset || last - m_offset >= m_previous.size())
+            throw std::runtime_error("sharded: position out of the shard");
+
+        const size_t first = part.values.size();
+        while (last != none && last >= m_offset) {
+            part.values.push_back(m_numbers[last - m_offset]);
+            part.indices.push_back(last);
+            last = m_previous[last - m_offset];
+        }
+        std::reverse(part.values.begin() + first, part.values.end());
+        std::reverse(part.indices.begin() + first, part.indices.end());
+        return last;
+    }
+};
+
+#if defined(__unix__)
+
+// MSG_NOSIGNAL: if the peer has exited, fail with EPIPE instead of being
+// killed by SIGPIPE, so that the error can be handled.
+void write_all(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) throw std::runtime_error("sharded: write failed");
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+void read_all(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t received = ::read(fd, bytes, size);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) throw std::runtime_error("sharded: read failed");
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+}
+
+template <typename T> void send(int fd, const std::vector<T>& list) {
+    const uint64_t size = list.size();
+    write_all(fd, &size, sizeof(size));
+    write_all(fd, list.data(), size * sizeof(T));
+}
+
+template <typename T> std::vector<T> receive(int fd) {
+    uint64_t size = 0;
+    read_all(fd, &size, sizeof(size));
+    std::vector<T> list(size);
+    read_all(fd, list.data(), size * sizeof(T));
+    return list;
+}
+
+// the worker side of the protocol: receives the tails of the previous shards
+// and sends them back updated, then sends its part of the subset ending at
+// the position it is sent (or 'none' if the subset ends before the shard).
+void work(int fd, Shard& shard) {
+    Tails tails;
+    tails.values = receive<int>(fd);
+    tails.positions = receive<uint64_t>(fd);
+    if (tails.positions.size() != tails.values.size())
+        throw std::runtime_error("sharded: invalid tails");
+
+    shard.extend(tails);
+    send(fd, tails.values);
+    send(fd, tails.positions);
+
+    uint64_t last = none;
+    read_all(fd, &last, sizeof(last));
+
+    RobustIncreasingSubset part;
+    const uint64_t previous = last == none ? none : shard.backtrack(last, part);
+    send(fd, part.values);
+    send(fd, std::vector<uint64_t>(part.indices.begin(), part.indices.end()));
+    write_all(fd, &previous, sizeof(previous));
+}
+
+// computes the longest increasing subset of 'numbers' with one worker
+// process per shard, communicating with the coordinator (this process)
+// through a local socket.
+// if 'exchanged' is not null, it receives the size in bytes of the tails and
+// of the parts of the subset exchanged with the workers.
+RobustIncreasingSubset
+longest_increasing_subset(const std::vector<int>& numbers, size_t processes,
+                          size_t* exchanged = nullptr) {
+    processes = std::max<size_t>(1, std::min(processes, numbers.size()));
+
+    std::vector<size_t> bounds(processes + 1);
+    for (size_t i = 0; i <= processes; ++i)
+        bounds[i] = numbers.size() * i / processes;
+
+    std::vector<int> sockets;
+    std::vector<pid_t> workers;
+    sockets.reserve(processes);
+    workers.reserve(processes);
+
+    // closing the sockets makes the workers that are still waiting fail, so
+    // that they can be reaped
+    auto stop = [&]() {
+        for (int fd : sockets)
+            ::close(fd);
+        for (pid_t pid : workers)
+            ::waitpid(pid, nullptr, 0);
+    };
+
+    RobustIncreasingSubset result;
+    try {
+        // the workers inherit the input, but only read their shard
+        std::cout.flush();
+        for (size_t i = 0; i < processes; ++i) {
+            int fds[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+                throw std::runtime_error("sharded: socketpair failed");
+
+            const pid_t pid = ::fork();
+            if (pid < 0) {
+                ::close(fds[0]);
+                ::close(fds[1]);
+                throw std::runtime_error("sharded: fork failed");
+            }
+
+            if (pid == 0) {
+                ::close(fds[0]);
+                for (int fd : sockets)
+                    ::close(fd);
+                int status = 0;
+                try {
+                    Shard shard{std::vector<int>(numbers.begin() + bounds[i],
+                                                 numbers.begin() +
+                                                     bounds[i + 1]),
+                                bounds[i]};
+                    work(fds[1], shard);
+                } catch (...) {
+                    status = 1;
+                }
+                ::_exit(status);
+            }
+
+            ::close(fds[1]);
+            sockets.push_back(fds[0]);
+            workers.push_back(pid);
+        }
+
+        size_t bytes = 0;
+        Tails tails;
+        const size_t entry = sizeof(int) + sizeof(uint64_t);
+        for (int fd : sockets) {
+            send(fd, tails.values);
+            send(fd, tails.positions);
+            bytes += tails.values.size() * entry;
+            tails.values = receive<int>(fd);
+            tails.positions = receive<uint64_t>(fd);
+            bytes += tails.values.size() * entry;
+        }
+
+        // the parts of the subset, from the last shard to the first
+        std::vector<RobustIncreasingSubset> parts(processes);
+        uint64_t last = tails.positions.empty() ? none : tails.positions.back();
+        for (size_t i = processes; i > 0; --i) {
+            const uint64_t request = last >= bounds[i - 1] ? last : none;
+            write_all(sockets[i - 1], &request, sizeof(request));
+
+            parts[i - 1].values = receive<int>(sockets[i - 1]);
+            const std::vector<uint64_t> indices =
+                receive<uint64_t>(sockets[i - 1]);
+            parts[i - 1].indices.assign(indices.begin(), indices.end());
+            uint64_t previous = none;
+            read_all(sockets[i - 1], &previous, sizeof(previous));
+            if (request != none) last = previous;
+
+            bytes +=
+                sizeof(request) + sizeof(previous) + indices.size() * entry;
+        }
+
+        for (const RobustIncreasingSubset& part : parts) {
+            result.values.insert(result.values.end(), part.values.begin(),
+                                 part.values.end());
+            result.indices.insert(result.indices.end(), part.indices.begin(),
+                                  part.indices.end());
+        }
+        if (exchanged) *exchanged = bytes;
+    } catch (...) {
+        stop();
+        throw;
+    }
+
+    stop();
+    return result;
+}
+
+#endif // defined(__unix__)
+
+} // namespace sharded
+
+// the indices of an increasing subset are themselves increasing, and storing
+// them as 64-bit integers wastes most of the bits.
+// Elias-Fano encoding stores n increasing integers lower than u in about
+// n * (2 + log2(u / n)) bits: each integer is split into its 'l' low bits,
+// stored as is, and its high bits, stored in unary as the gaps in a bit
+// vector where the i-th element sets bit (high + i).
+//
+// example:
+// with u = 32, the list [3, 4, 9, 20] gives l = 3:
+// low bits are [3, 4, 1, 4] and high parts [0, 0, 1, 2], so the bits at
+// positions 0, 1, 3 and 5 of the high bit vector are set.
+//
+// random access needs the position of the i-th set bit: the position of
+// every 64-th set bit is sampled, and blocks of 64 set bits spanning more
+// than 32 words store all their positions instead, so that at most 32 words
+// are scanned. as the high bit vector has at most 2n + 1 bits, this costs at
+// most 4 more bits per integer, and usually nothing.
+//
+// all the data lives in a single array of 64-bit words, which can be written
+// to a file and used in place, e.g. after mapping the file in memory.
+class EliasFanoIndices {
+  private:
+    enum Header {
+        Magic,
+        Size,
+        Universe,
+        LowBits,
+        LowWords,
+        HighWords,
+        Samples,
+        Explicit,
+        HeaderSize
+    };
+
+    static constexpr uint64_t magic = 0x3130304f46414c45; // "ELAFO001"
+    static constexpr size_t block = 64;
+    static constexpr size_t max_block_words = 32;
+    static constexpr uint64_t explicit_flag = uint64_t(1) << 63;
+
+    std::vector<uint64_t> m_storage;
+    const uint64_t* m_words = nullptr; // if not owned
+
+    const uint64_t* words() const {
+        return m_storage.empty() ? m_words : m_storage.data();
+    }
+    uint64_t header(Header h) const { return words()[h]; }
+    const uint64_t* low() const { return words() + HeaderSize; }
+    const uint64_t* high() const { return low() + header(LowWords); }
+    const uint64_t* samples() const { return high() + header(HighWords); }
+    const uint64_t* explicit_positions() const {
+        return samples() + header(Samples);
+    }
+
+    static int popcount(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(w);
+#else
+        int count = 0;
+        for (; w != 0; w &= w - 1)
+            ++count;
+        return count;
+#endif
+    }
+
+    static int lowest_bit(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(w);
+#else
+        int index = 0;
+        for (; (w & 1) == 0; w >>= 1)
+            ++index;
+        return index;
+#endif
+    }
+
+    // the i-th integer of 'l' bits packed in 'low'
+    static uint64_t low_part(const uint64_t* low, uint64_t l, size_t i) {
+        if (l == 0) return 0;
+
+        const uint64_t bit = i * l;
+        const uint64_t* w = low + bit / 64;
+        const unsigned shift = bit % 64;
+        uint64_t value = w[0] >> shift;
+        if (shift + l > 64) value |= w[1] << (64 - shift);
+        return value & ((uint64_t(1) << l) - 1);
+    }
+
+    // position of the i-th set bit of the high bit vector
+    uint64_t select(size_t i) const {
+        const uint64_t sample = samples()[i / block];
+        size_t rank = i % block;
+
+        if (sample & explicit_flag)
+            return explicit_positions()[(sample & ~explicit_flag) + rank];
+
+        const uint64_t* h = high();
+        size_t w = sample / 64;
+        uint64_t word = h[w] & (~uint64_t(0) << (sample % 64));
+        for (size_t count = popcount(word); rank >= count;
+             count = popcount(word)) {
+            rank -= count;
+            word = h[++w];
+        }
+
+        for (; rank > 0; --rank)
+            word &= word - 1;
+        return w * 64 + lowest_bit(word);
+    }
+
+    EliasFanoIndices(const uint64_t* words) : m_words(words) {}
+
+    // sizes of the arrays, which only depend on the number of integers and
+    // the universe
+    struct Layout {
+        uint64_t low_bits = 0;
+        uint64_t low_words = 0;
+        uint64_t high_bits = 0;
+        uint64_t high_words = 0;
+        uint64_t samples = 0;
+    };
+
+    static Layout layout(uint64_t n, uint64_t u) {
+        Layout result;
+        while (n > 0 && (u / n) >> (result.low_bits + 1) != 0)
+            ++result.low_bits;
+
+        const uint64_t l = result.low_bits;
+        result.high_bits = n == 0 ? 0 : n + (u >> l) + 1;
+        result.low_words = (n * l + 63) / 64 + 1;
+        result.high_words = (result.high_bits + 63) / 64 + 1;
+        result.samples = (n + block - 1) / block;
+        return result;
+    }
+
+    // checks that the header is consistent and that every sample and
+    // explicit position points to the right set bit, so that accesses stay
+    // within the arrays.
+    // this reads the high bit vector once (about 2 bits per integer).
+    void validate(size_t bytes) const {
+        auto fail = []() {
+            throw std::runtime_error("EliasFanoIndices: invalid data");
+        };
+
+        const uint64_t n = header(Size);
+        const uint64_t u = header(Universe);
+        // every integer uses at least one bit, which also bounds the sizes
+        // computed below
+        if (u == 0 || n > u || n > bytes * 8) fail();
+
+        const Layout expected = layout(n, u);
+        if (header(LowBits) != expected.low_bits ||
+            header(LowWords) != expected.low_words ||
+            header(HighWords) != expected.high_words ||
+            header(Samples) != expected.samples ||
+            header(Explicit) > n)
+            fail();
+        if (this->bytes() != bytes) fail();
+
+        const uint64_t* h = high();
+        const uint64_t* sample = samples();
+        uint64_t rank = 0; // number of set bits before word w
+        size_t w = 0;
+
+        // 'pos' must be the position of the set bit of rank 'index'. the
+        // positions are checked in increasing order of 'index', so the
+        // words are scanned once.
+        auto check = [&](uint64_t pos, uint64_t index) {
+            if (pos >= expected.high_bits || pos / 64 < w) fail();
+            for (; w < pos / 64; ++w)
+                rank += popcount(h[w]);
+
+            const uint64_t word = h[w];
+            const uint64_t below = word & ((uint64_t(1) << (pos % 64)) - 1);
+            if (!(word >> (pos % 64) & 1) || rank + popcount(below) != index)
+                fail();
+        };
+
+        for (size_t b = 0; b < expected.samples; ++b) {
+            const uint64_t first = b * block;
+            const uint64_t count = std::min<uint64_t>(block, n - first);
+
+            if (sample[b] & explicit_flag) {
+                const uint64_t offset = sample[b] & ~explicit_flag;
+                if (offset > header(Explicit) ||
+                    header(Explicit) - offset < count)
+                    fail();
+                for (uint64_t i = 0; i < count; ++i)
+                    check(explicit_positions()[offset + i], first + i);
+            } else {
+                check(sample[b], first);
+            }
+        }
+
+        for (; w < expected.high_words; ++w)
+            rank += popcount(h[w]);
+        if (rank != n) fail();
+    }
+
+  public:
+    EliasFanoIndices() : EliasFanoIndices(std::vector<size_t>(), 0) {}
+
+    // encodes 'indices', which must be strictly increasing and lower than
+    // 'universe' (throws std::invalid_argument otherwise)
+    EliasFanoIndices(const std::vector<size_t>& indices, size_t universe) {
+        for (size_t i = 0; i < indices.size(); ++i) {
+            if (indices[i] >= universe ||
+                (i > 0 && indices[i] <= indices[i - 1]))
+                throw std::invalid_argument(
+                    "EliasFanoIndices: indices must be strictly increasing "
+                    "and lower than the universe");
+        }
+
+        const uint64_t n = indices.size();
+        const uint64_t u = std::max<uint64_t>(universe, 1);
+        const Layout sizes = layout(n, u);
+        const uint64_t l = sizes.low_bits;
+        const uint64_t low_words = sizes.low_words;
+        const uint64_t high_words = sizes.high_words;
+        const uint64_t sample_count = sizes.samples;
+
+        std::vector<uint64_t> low(low_words, 0), high(high_words, 0);
+        for (size_t i = 0; i < n; ++i) {
+            if (l > 0) {
+                const uint64_t value = indices[i] & ((uint64_t(1) << l) - 1);
+                const uint64_t bit = i * l;
+                low[bit / 64] |= value << (bit % 64);
+                if (bit % 64 + l > 64)
+                    low[bit / 64 + 1] |= value >> (64 - bit % 64);
+            }
+            const uint64_t pos = (indices[i] >> l) + i;
+            high[pos / 64] |= uint64_t(1) << (pos % 64);
+        }
+
+        // samples; blocks spanning too many words store their positions
+        std::vector<uint64_t> sampled, positions;
+        for (size_t b = 0; b < sample_count; ++b) {
+            const size_t first = b * block;
+            const size_t last = std::min<size_t>(first + block, n) - 1;
+            const uint64_t begin = (indices[first] >> l) + first;
+            const uint64_t end = (indices[last] >> l) + last;
+
+            if (end / 64 - begin / 64 < max_block_words) {
+                sampled.push_back(begin);
+            } else {
+                sampled.push_back(explicit_flag | positions.size());
+                for (size_t i = first; i <= last; ++i)
+                    positions.push_back((indices[i] >> l) + i);
+            }
+        }
+
+        m_storage = {magic,     n,          u,           l,
+                     low_words, high_words, sample_count, positions.size()};
+        m_storage.insert(m_storage.end(), low.begin(), low.end());
+        m_storage.insert(m_storage.end(), high.begin(), high.end());
+        m_storage.insert(m_storage.end(), sampled.begin(), sampled.end());
+        m_storage.insert(m_storage.end(), positions.begin(), positions.end());
+    }
+
+    // uses encoded data without copying or decoding it; 'data' must outlive
+    // the returned object and be aligned on 8 bytes (throws
+    // std::runtime_error if it is misaligned or inconsistent)
+    static EliasFanoIndices view(const void* data, size_t bytes) {
+        if (reinterpret_cast<std::uintptr_t>(data) % alignof(uint64_t) != 0)
+            throw std::runtime_error("EliasFanoIndices: misaligned data");
+
+        const uint64_t* words = static_cast<const uint64_t*>(data);
+        if (bytes % sizeof(uint64_t) != 0 ||
+            bytes < HeaderSize * sizeof(uint64_t) || words[Magic] != magic)
+            throw std::runtime_error("EliasFanoIndices: invalid data");
+
+        EliasFanoIndices result{words};
+        result.validate(bytes);
+        return result;
+    }
+
+    size_t size() const { return header(Size); }
+    size_t universe() const { return header(Universe); }
+
+    // the encoded data, to be written as is
+    const void* data() const { return words(); }
+    size_t bytes() const {
+        return (HeaderSize + header(LowWords) + header(HighWords) +
+                header(Samples) + header(Explicit)) *
+               sizeof(uint64_t);
+    }
+
+    size_t operator[](size_t i) const {
+        const uint64_t l = header(LowBits);
+        return ((select(i) - i) << l) | low_part(low(), l, i);
+    }
+
+    // sequential decoding, one word of the high bit vector at a time
+    class const_iterator {
+      private:
+        const EliasFanoIndices* m_indices;
+        const uint64_t* m_low;
+        const uint64_t* m_high;
+        uint64_t m_low_bits;
+        size_t m_size;
+        size_t m_index;
+        size_t m_word_index = 0;
+        uint64_t m_word = 0; // set bits not visited yet
+
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = size_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const size_t*;
+        using reference = size_t;
+
+        const_iterator(const EliasFanoIndices* indices, size_t index)
+            : m_indices(indices), m_low(indices->low()),
+              m_high(indices->high()),
+              m_low_bits(indices->header(LowBits)), m_size(indices->size()),
+              m_index(index) {
+            if (m_index < m_size) {
+                const uint64_t pos = m_indices->select(m_index);
+                m_word_index = pos / 64;
+                m_word = m_high[m_word_index] & (~uint64_t(0) << (pos % 64));
+            }
+        }
+
+        size_t operator*() const {
+            const uint64_t pos = m_word_index * 64 + lowest_bit(m_word);
+            return ((pos - m_index) << m_low_bits) |
+                   low_part(m_low, m_low_bits, m_index);
+        }
+
+        const_iterator& operator++() {
+            if (++m_index < m_size) {
+                m_word &= m_word - 1;
+                while (m_word == 0)
+                    m_word = m_high[++m_word_index];
+            }
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return m_index == other.m_index;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return m_index != other.m_index;
+        }
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    std::vector<size_t> to_vector() const {
+        return std::vector<size_t>(begin(), end());
+    }
+};
+
 void print(const std::vector<int>& numbers) {
     std::cout << "[";
 
@@ -359,6 +1652,15 @@ static const std::vector<int> three_sixty_five = {
     192, 76,  224, 131, 150, 132, 227, 263, 164, 227, 194, 136, 85,  171, 60,
     253, 198, 118, 133, 258};
 
+// runs 'f' once and returns the elapsed time, counted in units of 'Duration'
+template <typename Duration, typename F> double measure(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, typename Duration::period>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
 int main(int argc, char** argv) {
 
     {
@@ -466,6 +1768,118 @@ int main(int argc, char** argv) {
         }
     }
 
+    {
+        std::cout << "---\n\nCompute the longest subset with at most k bad "
+                     "steps"
+                  << std::endl;
+
+        for (size_t k : {0, 1, 3}) {
+            RobustIncreasingSubset subset =
+                longest_robust_increasing_subset(three_sixty_five, k);
+            std::cout << "k=" << k << ", length=" << subset.values.size()
+                      << ", bad steps at positions: ";
+            print(std::vector<int>(subset.violations.begin(),
+                                   subset.violations.end()));
+        }
+
+        // check against the exhaustive algorithm on small random lists
+        std::mt19937 rng{42};
+        std::uniform_int_distribution<int> dist{0, 9};
+        bool ok = true;
+
+        for (int test = 0; test < 200; ++test) {
+            std::vector<int> numbers(12);
+            for (int& n : numbers)
+                n = dist(rng);
+
+            for (size_t k = 0; k <= 3; ++k) {
+                RobustIncreasingSubset subset =
+                    longest_robust_increasing_subset(numbers, k);
+                ok = ok && subset.values.size() ==
+                               compute_length_of_longest_robust_subset(
+                                   numbers, k) &&
+                     subset.violations.size() <= k;
+            }
+
+            ok = ok && longest_robust_increasing_subset(numbers, 0)
+                               .values.size() ==
+                           compute_length_of_longest_increasing_subset(
+                               numbers);
+        }
+
+        // any number of bad steps allows to keep the whole input
+        ok = ok && longest_robust_increasing_subset(
+                       three_sixty_five, std::numeric_limits<size_t>::max())
+                           .values.size() == three_sixty_five.size();
+
+        std::cout << (ok ? "--> Ok" : "--> NOT ok :(") << std::endl;
+    }
+
+    {
+        std::cout << "---\n\nCompute the longest increasing subset over all "
+                     "rotations"
+                  << std::endl;
+
+        // naive version: one computation per rotation
+        auto naive = [](const std::vector<int>& numbers) {
+            std::vector<size_t> lengths;
+            std::vector<int> rotation = numbers;
+            for (size_t s = 0; s < numbers.size(); ++s) {
+                lengths.push_back(longest_increasing_subset_length(rotation));
+                std::rotate(rotation.begin(), rotation.begin() + 1,
+                            rotation.end());
+            }
+            return lengths;
+        };
+
+        std::vector<size_t> expected;
+        CyclicIncreasingSubsetLength cyclic;
+        double naive_ms = measure<std::chrono::milliseconds>(
+            [&]() { expected = naive(three_sixty_five); });
+        double seaweed_ms = measure<std::chrono::milliseconds>([&]() {
+            cyclic = cyclic_longest_increasing_subset_length(three_sixty_five,
+                                                             true);
+        });
+
+        std::cout << "365 elements: length=" << cyclic.length
+                  << " (rotation " << cyclic.rotation << "), "
+                  << (cyclic.lengths == expected ? "--> Ok" : "--> NOT ok :(")
+                  << ", naive: " << naive_ms << " ms, seaweed: " << seaweed_ms
+                  << " ms" << std::endl;
+
+        // small random lists, with many duplicates
+        std::mt19937 rng{42};
+        bool ok = true;
+        for (int trial = 0; trial < 200; ++trial) {
+            std::uniform_int_distribution<int> size{0, 40};
+            std::uniform_int_distribution<int> value{0, 15};
+            std::vector<int> numbers(size(rng));
+            for (int& n : numbers)
+                n = value(rng);
+            ok &= cyclic_longest_increasing_subset_length(numbers, true)
+                      .lengths == naive(numbers);
+        }
+        std::cout << "random lists: " << (ok ? "--> Ok" : "--> NOT ok :(")
+                  << std::endl;
+
+        // a random "daily" pattern, repeated
+        std::uniform_int_distribution<int> dist{0, 999};
+        std::vector<int> day(1000);
+        for (int& n : day)
+            n = dist(rng);
+        std::vector<int> periodic;
+        for (int d = 0; d < 1000; ++d)
+            periodic.insert(periodic.end(), day.begin(), day.end());
+
+        double periodic_ms = measure<std::chrono::milliseconds>([&]() {
+            cyclic = cyclic_longest_increasing_subset_length(periodic);
+        });
+
+        std::cout << periodic.size() << " elements: length=" << cyclic.length
+                  << " (rotation " << cyclic.rotation << "), seaweed: "
+                  << periodic_ms << " ms" << std::endl;
+    }
+
     {
         std::cout << "---\n\nCompute increasing subsets iteratively";
 
@@ -483,4 +1897,264 @@ int main(int argc, char** argv) {
             std::cout << std::endl;
         }
     }
+
+    {
+        std::cout << "---\n\nQuery past versions of the increasing subsets"
+                  << std::endl;
+
+        PersistentIncreasingSubsetExtractor builder;
+        builder.feed(three_sixty_five);
+
+        for (size_t v : {size_t(0), size_t(10), size_t(100), size_t(365)}) {
+            std::cout << "Version " << v << ": length "
+                      << builder.longest_increasing_subset_length(v) << ", ";
+            print(builder.longest_increasing_subset(v));
+        }
+
+        // compare with the non-persistent algorithm on each prefix
+        bool ok = true;
+        for (size_t v = 0; v <= builder.version(); ++v) {
+            std::vector<int> prefix(three_sixty_five.begin(),
+                                    three_sixty_five.begin() + v);
+            std::vector<int> subset = builder.longest_increasing_subset(v);
+            ok &= subset.size() ==
+                  static_cast<size_t>(longest_increasing_subset_length(prefix));
+            ok &= std::adjacent_find(subset.begin(), subset.end(),
+                                     std::greater_equal<int>()) ==
+                  subset.end();
+
+            // the subset must be a subsequence of the prefix
+            size_t matched = 0;
+            for (size_t i = 0; i < prefix.size() && matched < subset.size();
+                 ++i)
+                matched += prefix[i] == subset[matched];
+            ok &= matched == subset.size();
+        }
+
+        std::cout << (ok ? "--> Ok" : "--> NOT ok :(") << " ("
+                  << builder.node_count() << " nodes for "
+                  << builder.version() << " versions)" << std::endl;
+    }
+
+    {
+        std::cout << "---\n\nStore the indices of a subset with Elias-Fano"
+                  << std::endl;
+
+        EliasFanoIndices example{{3, 4, 9, 20}, 32};
+        for (size_t index : example)
+            std::cout << index << " ";
+        std::cout << "(" << example.bytes() << " bytes)" << std::endl;
+
+        // a noisy increasing trend, with a long increasing subset
+        std::mt19937 rng{11};
+        std::uniform_int_distribution<int> noise{-100, 100};
+        std::vector<int> numbers(4000000);
+        for (size_t i = 0; i < numbers.size(); ++i)
+            numbers[i] = static_cast<int>(i) + noise(rng);
+
+        const std::vector<size_t> indices =
+            longest_robust_increasing_subset(numbers, 0).indices;
+        const EliasFanoIndices encoded{indices, numbers.size()};
+
+        std::cout << indices.size() << " indices: "
+                  << 8.0 * encoded.bytes() / indices.size()
+                  << " bits per index, instead of " << 8 * sizeof(size_t)
+                  << std::endl;
+
+        size_t sum = 0;
+        double vector_ns = measure<std::chrono::nanoseconds>([&]() {
+            for (size_t index : indices)
+                sum += index;
+        });
+        size_t decoded_sum = 0;
+        double decode_ns = measure<std::chrono::nanoseconds>([&]() {
+            for (size_t index : encoded)
+                decoded_sum += index;
+        });
+
+        std::uniform_int_distribution<size_t> position{0, indices.size() - 1};
+        std::vector<size_t> queries(1000000);
+        for (size_t& q : queries)
+            q = position(rng);
+        bool ok = sum == decoded_sum && encoded.to_vector() == indices;
+        double access_ns = measure<std::chrono::nanoseconds>([&]() {
+            for (size_t q : queries)
+                ok &= encoded[q] == indices[q];
+        });
+
+        std::cout << "sequential: " << vector_ns / indices.size()
+                  << " ns/index (vector), " << decode_ns / indices.size()
+                  << " ns/index (decoded); random access: "
+                  << access_ns / queries.size() << " ns/index, "
+                  << (ok ? "--> Ok" : "--> NOT ok :(") << std::endl;
+
+        // invalid input and corrupted data are rejected
+        size_t rejected = 0;
+        try {
+            EliasFanoIndices{{1000}, 2};
+        } catch (const std::invalid_argument&) {
+            ++rejected;
+        }
+        try {
+            EliasFanoIndices{{4, 3}, 32};
+        } catch (const std::invalid_argument&) {
+            ++rejected;
+        }
+        std::vector<uint64_t> corrupted(
+            static_cast<const uint64_t*>(encoded.data()),
+            static_cast<const uint64_t*>(encoded.data()) +
+                encoded.bytes() / sizeof(uint64_t));
+        corrupted[6] += 1; // number of samples
+        try {
+            EliasFanoIndices::view(corrupted.data(), encoded.bytes());
+        } catch (const std::runtime_error&) {
+            ++rejected;
+        }
+        corrupted[6] -= 1;
+        corrupted.back() = ~uint64_t(0); // last sample or position
+        try {
+            EliasFanoIndices::view(corrupted.data(), encoded.bytes());
+        } catch (const std::runtime_error&) {
+            ++rejected;
+        }
+        std::cout << "rejected " << rejected << " of 4 invalid inputs "
+                  << (rejected == 4 ? "--> Ok" : "--> NOT ok :(") << std::endl;
+
+#if defined(__unix__)
+        // the encoded data is used in place after mapping the file
+        char path[] = "/tmp/increasing-subset-indices-XXXXXX";
+        const int fd = ::mkstemp(path);
+        const char* bytes = static_cast<const char*>(encoded.data());
+        size_t written = 0;
+        while (fd >= 0 && written < encoded.bytes()) {
+            const ssize_t n =
+                ::write(fd, bytes + written, encoded.bytes() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            written += static_cast<size_t>(n);
+        }
+
+        void* mapped = written != encoded.bytes()
+                           ? MAP_FAILED
+                           : ::mmap(nullptr, encoded.bytes(), PROT_READ,
+                                    MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            const EliasFanoIndices view =
+                EliasFanoIndices::view(mapped, encoded.bytes());
+            std::cout << "mapped from " << path << ": "
+                      << (view.to_vector() == indices &&
+                                  view[indices.size() / 2] ==
+                                      indices[indices.size() / 2]
+                              ? "--> Ok"
+                              : "--> NOT ok :(")
+                      << std::endl;
+            ::munmap(mapped, encoded.bytes());
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(path);
+        }
+#endif
+    }
+
+    {
+        std::cout << "---\n\nCompute the longest increasing subset by shards"
+                  << std::endl;
+
+        // checks that 'subset' is an increasing subset of 'numbers' of the
+        // expected length
+        auto check = [](const std::vector<int>& numbers,
+                        const RobustIncreasingSubset& subset) {
+            const size_t expected =
+                longest_robust_increasing_subset(numbers, 0).values.size();
+            bool ok = subset.values.size() == expected;
+            ok &= subset.values.size() == subset.indices.size();
+            for (size_t i = 0; ok && i < subset.values.size(); ++i) {
+                ok &= subset.indices[i] < numbers.size() &&
+                      numbers[subset.indices[i]] == subset.values[i];
+                ok &= i == 0 || (subset.indices[i - 1] < subset.indices[i] &&
+                                 subset.values[i - 1] < subset.values[i]);
+            }
+            return ok;
+        };
+
+        // the coordinator and the workers, without the processes
+        auto run = [](const std::vector<int>& numbers, size_t shards) {
+            std::vector<sharded::Shard> parts;
+            sharded::Tails tails;
+            for (size_t i = 0; i < shards; ++i) {
+                const size_t begin = numbers.size() * i / shards;
+                const size_t end = numbers.size() * (i + 1) / shards;
+                parts.emplace_back(std::vector<int>(numbers.begin() + begin,
+                                                    numbers.begin() + end),
+                                   begin);
+                parts.back().extend(tails);
+            }
+
+            RobustIncreasingSubset result;
+            uint64_t last = tails.positions.empty() ? sharded::none
+                                                    : tails.positions.back();
+            for (size_t i = shards; i > 0 && last != sharded::none; --i) {
+                if (last < numbers.size() * (i - 1) / shards) continue;
+                RobustIncreasingSubset part;
+                last = parts[i - 1].backtrack(last, part);
+                result.values.insert(result.values.begin(), part.values.begin(),
+                                     part.values.end());
+                result.indices.insert(result.indices.begin(),
+                                      part.indices.begin(), part.indices.end());
+            }
+            return result;
+        };
+
+        std::mt19937 rng{7};
+        bool ok = true;
+        for (int trial = 0; trial < 300; ++trial) {
+            std::uniform_int_distribution<int> size{0, 60};
+            std::uniform_int_distribution<int> value{-10, 20};
+            std::uniform_int_distribution<size_t> shards{1, 6};
+            std::vector<int> numbers(size(rng));
+            for (int& n : numbers)
+                n = value(rng);
+            ok &= check(numbers, run(numbers, shards(rng)));
+        }
+        std::cout << "random lists: " << (ok ? "--> Ok" : "--> NOT ok :(")
+                  << std::endl;
+
+#if defined(__unix__)
+        RobustIncreasingSubset subset =
+            sharded::longest_increasing_subset(three_sixty_five, 4);
+        std::cout << "365 elements, 4 processes: length "
+                  << subset.values.size() << ", "
+                  << (check(three_sixty_five, subset) ? "--> Ok"
+                                                      : "--> NOT ok :(")
+                  << std::endl;
+
+        std::vector<int> numbers(50000);
+        std::uniform_int_distribution<int> value{0, 1000000};
+        for (int& n : numbers)
+            n = value(rng);
+
+        size_t expected = 0;
+        const double single_ms = measure<std::chrono::milliseconds>([&]() {
+            expected =
+                longest_robust_increasing_subset(numbers, 0).values.size();
+        });
+        std::cout << numbers.size() << " elements, single process: length "
+                  << expected << ", " << single_ms << " ms" << std::endl;
+
+        for (size_t processes : {1, 2, 4, 8}) {
+            size_t exchanged = 0;
+            const double elapsed = measure<std::chrono::milliseconds>([&]() {
+                subset = sharded::longest_increasing_subset(numbers, processes,
+                                                            &exchanged);
+            });
+            std::cout << processes << " processes: length "
+                      << subset.values.size() << ", "
+                      << (check(numbers, subset) ? "--> Ok" : "--> NOT ok :(")
+                      << ", " << elapsed << " ms, " << exchanged
+                      << " bytes exchanged for " << numbers.size() * sizeof(int)
+                      << " bytes of input" << std::endl;
+        }
+#endif
+    }
 }
@@ -1,11 +1,28 @@
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <iostream>
+#include <sstream>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
 
 namespace v0
 {
@@ -59,6 +76,651 @@ std::vector<R> map(const std::vector<T>& vec, F&& fun)
   return res;
 }
 
+/**
+ * \brief a non-owning view of contiguous elements
+ *
+ * Stands for std::span, which is only available since C++20.
+ */
+template<typename T>
+struct span
+{
+  T* ptr = nullptr;
+  std::size_t count = 0;
+
+  T* data() const { return ptr; }
+  std::size_t size() const { return count; }
+  T* begin() const { return ptr; }
+  T* end() const { return ptr + count; }
+  T& operator[](std::size_t i) const { return ptr[i]; }
+};
+
+namespace details
+{
+
+// extracts In and Out from a batch signature void(span<const In>, span<Out>)
+template<typename Sig>
+struct batch_signature { };
+
+template<typename In, typename Out>
+struct batch_signature<void(span<const In>, span<Out>)>
+{
+  using input_type = In;
+  using output_type = Out;
+};
+
+template<typename In, typename Out>
+struct batch_signature<void(*)(span<const In>, span<Out>)> : batch_signature<void(span<const In>, span<Out>)> { };
+
+template<typename C, typename In, typename Out>
+struct batch_signature<void(C::*)(span<const In>, span<Out>)> : batch_signature<void(span<const In>, span<Out>)> { };
+
+template<typename C, typename In, typename Out>
+struct batch_signature<void(C::*)(span<const In>, span<Out>) const> : batch_signature<void(span<const In>, span<Out>)> { };
+
+// function pointers, and functors with a single non-template operator()
+template<typename F, typename = void>
+struct batch_traits : batch_signature<std::decay_t<F>> { };
+
+template<typename F>
+struct batch_traits<F, std::void_t<decltype(&std::decay_t<F>::operator())>>
+  : batch_signature<decltype(&std::decay_t<F>::operator())> { };
+
+template<typename F, typename T, typename = void>
+struct is_batch_function : std::false_type { };
+
+template<typename F, typename T>
+struct is_batch_function<F, T, std::void_t<typename batch_traits<F>::output_type>>
+  : std::is_same<typename batch_traits<F>::input_type, T> { };
+
+/**
+ * \brief number of elements processed per call of a batch functor
+ *
+ * Input and output blocks together take about half of a typical 32 KiB
+ * L1 data cache.
+ */
+template<typename T, typename R>
+constexpr std::size_t batch_size()
+{
+  return std::max<std::size_t>(1, (16 * 1024) / (sizeof(T) + sizeof(R)));
+}
+
+} // namespace details
+
+/**
+ * \brief a map() function for batch functors
+ * \tparam T  input element type
+ * \tparam F  functor-like type, with signature void(span<const T>, span<R>)
+ * \tparam R  output element type
+ * \param vec  input vector of elements
+ * \param fun  function transforming a block of elements
+ *
+ * Selected when \a fun takes a block of inputs and a block of outputs of
+ * the same size, instead of a single element.
+ * \a fun is called once per cache-sized block, which amortizes the cost
+ * of calls that cannot be inlined (std::function, functions from another
+ * library) and lets \a fun use SIMD on the block.
+ *
+ * \note R must be default-constructible: \a fun writes to elements that
+ * already exist.
+ */
+template<typename T, typename F, typename = std::enable_if_t<details::is_batch_function<F, T>::value>,
+  typename R = typename details::batch_traits<F>::output_type>
+std::vector<R> map(const std::vector<T>& vec, F&& fun)
+{
+  constexpr std::size_t block = details::batch_size<T, R>();
+  std::vector<R> res(vec.size());
+
+  for (std::size_t i = 0; i < vec.size(); i += block)
+  {
+    const std::size_t n = std::min(block, vec.size() - i);
+    fun(span<const T>{ vec.data() + i, n }, span<R>{ res.data() + i, n });
+  }
+
+  return res;
+}
+
+/**
+ * \brief an allocator-aware map() function
+ * \tparam T  input element type
+ * \tparam A  allocator of the input vector
+ * \tparam F  functor-like type
+ * \tparam Allocator  allocator used for the output vector
+ * \tparam R  output element type
+ * \param vec  input vector of elements
+ * \param fun  function to apply to each element
+ * \param alloc  allocator used for the output vector
+ *
+ * Same as map() but the output vector uses (a rebound copy of) \a alloc
+ * instead of the default allocator.
+ *
+ * \note \a Allocator does not need to have R as value type
+ */
+template<typename T, typename A, typename F, typename Allocator,
+  typename = typename Allocator::value_type, typename R = typename std::invoke_result<F, T>::type>
+std::vector<R, typename std::allocator_traits<Allocator>::template rebind_alloc<R>>
+map(const std::vector<T, A>& vec, F&& fun, const Allocator& alloc)
+{
+  using OutputAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<R>;
+  std::vector<R, OutputAllocator> res{ OutputAllocator(alloc) };
+  res.reserve(vec.size());
+  std::transform(vec.begin(), vec.end(), std::back_inserter(res),
+    [&fun](const T& val) { return fun(val); });
+  return res;
+}
+
+/**
+ * \brief a map() function whose output is allocated from a memory resource
+ * \param vec  input vector of elements
+ * \param fun  function to apply to each element
+ * \param resource  memory resource used for the output vector
+ *
+ * Typically used with a std::pmr::monotonic_buffer_resource, so that the
+ * output lives in a caller-provided arena and is released all at once
+ * with it.
+ */
+template<typename T, typename A, typename F, typename R = typename std::invoke_result<F, T>::type>
+std::pmr::vector<R> map(const std::vector<T, A>& vec, F&& fun, std::pmr::memory_resource* resource)
+{
+  return map(vec, std::forward<F>(fun), std::pmr::polymorphic_allocator<R>(resource));
+}
+
+namespace details
+{
+
+template<typename T, std::size_t N, typename F, std::size_t... I>
+constexpr auto map_array(const std::array<T, N>& arr, F& fun, std::index_sequence<I...>)
+  -> std::array<typename std::invoke_result<F&, const T&>::type, N>
+{
+  return { { fun(arr[I])... } };
+}
+
+/**
+ * \brief returns the number of threads worth using for \a n elements
+ *
+ * Spawning a thread costs a lot more than processing a few elements,
+ * so each worker is given at least \a grain elements.
+ */
+inline std::size_t worker_count(std::size_t n, std::size_t grain = 4096)
+{
+  const std::size_t hw = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+  return std::max<std::size_t>(1, std::min(hw, n / grain));
+}
+
+/**
+ * \brief returns the first index of the \a c-th of \a k chunks of [0, n)
+ *
+ * Chunk boundaries only depend on (c, k, n), so several passes over the
+ * same data see the exact same partition.
+ */
+inline std::size_t chunk_begin(std::size_t c, std::size_t k, std::size_t n)
+{
+  return n * c / k;
+}
+
+/**
+ * \brief calls fun(c, begin, end) for each of the \a k chunks of [0, n)
+ *
+ * The first chunk is processed on the calling thread, the others on
+ * their own std::thread. The first exception thrown by a chunk, if any,
+ * is rethrown once all threads have been joined.
+ */
+template<typename F>
+void for_each_chunk(std::size_t n, std::size_t k, F&& fun)
+{
+  std::vector<std::exception_ptr> errors(k);
+  std::vector<std::thread> threads;
+  threads.reserve(k - 1);
+
+  auto run = [&](std::size_t c) {
+    try
+    {
+      fun(c, chunk_begin(c, k, n), chunk_begin(c + 1, k, n));
+    }
+    catch (...)
+    {
+      errors[c] = std::current_exception();
+    }
+  };
+
+  for (std::size_t c = 1; c < k; ++c)
+    threads.emplace_back(run, c);
+
+  run(0);
+
+  for (std::thread& t : threads)
+    t.join();
+
+  for (std::exception_ptr& e : errors)
+  {
+    if (e)
+      std::rethrow_exception(e);
+  }
+}
+
+} // namespace details
+
+/**
+ * \brief tag type used to select the multi-threaded overload of a function
+ */
+struct parallel_t { };
+constexpr parallel_t parallel{};
+
+/**
+ * \brief a compile-time map() function for fixed-size arrays
+ * \tparam T  input element type
+ * \tparam N  number of elements
+ * \tparam F  functor-like type
+ * \param arr  input array of elements
+ * \param fun  function to apply to each element
+ *
+ * Same as the std::vector overload, but the size of the output is known
+ * at compile time so the whole computation can be done in a constant
+ * expression if \a fun can (lambdas are implicitly constexpr since C++17).
+ * Useful for building lookup tables that cost nothing at startup.
+ *
+ * \note the output element type need not be default-constructible
+ */
+template<typename T, std::size_t N, typename F>
+constexpr auto map(const std::array<T, N>& arr, F&& fun)
+{
+  return details::map_array(arr, fun, std::make_index_sequence<N>());
+}
+
+/**
+ * \brief maps the elements that satisfy a predicate
+ * \tparam T  input element type
+ * \tparam P  predicate-like type
+ * \tparam F  functor-like type
+ * \tparam R  output element type
+ * \param vec  input vector of elements
+ * \param pred  predicate selecting the elements to transform
+ * \param fun  function to apply to each selected element
+ *
+ * Equivalent to filtering \a vec with \a pred and then calling map() on
+ * the result, but done in a single pass without any temporary vector.
+ * \a pred and \a fun are called exactly once per element (resp. selected
+ * element), in order.
+ */
+template<typename T, typename P, typename F, typename R = typename std::invoke_result<F, T>::type>
+std::vector<R> filter_map(const std::vector<T>& vec, P&& pred, F&& fun)
+{
+  std::vector<R> res;
+  for (const T& val : vec)
+  {
+    if (pred(val))
+      res.push_back(fun(val));
+  }
+  return res;
+}
+
+/**
+ * \brief multi-threaded version of filter_map()
+ *
+ * Works in two passes over the same partition of \a vec:
+ * - each worker evaluates \a pred on its chunk, remembering the result,
+ *   and counts the selected elements;
+ * - a prefix sum over the counts gives the exact size of the output and
+ *   the offset at which each worker writes, so the output is allocated
+ *   once and filled without any synchronization.
+ *
+ * \a pred is still called exactly once per element, but \a pred and \a fun
+ * must be safe to call concurrently.
+ *
+ * \note R must be default-constructible and move-assignable
+ * \note std::vector<bool> packs its elements, so workers writing next to each
+ * other would race: booleans are written to a vector of bytes that is converted
+ * at the end.
+ */
+template<typename T, typename P, typename F, typename R = typename std::invoke_result<F, T>::type>
+std::vector<R> filter_map(parallel_t, const std::vector<T>& vec, P&& pred, F&& fun)
+{
+  const std::size_t n = vec.size();
+  const std::size_t k = details::worker_count(n);
+
+  std::vector<unsigned char> selected(n);
+  std::vector<std::size_t> offsets(k + 1, 0);
+
+  details::for_each_chunk(n, k, [&](std::size_t c, std::size_t begin, std::size_t end) {
+    std::size_t count = 0;
+    for (std::size_t i = begin; i < end; ++i)
+    {
+      selected[i] = pred(vec[i]) ? 1 : 0;
+      count += selected[i];
+    }
+    offsets[c + 1] = count;
+  });
+
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+  using Slot = std::conditional_t<std::is_same<R, bool>::value, unsigned char, R>;
+  std::vector<Slot> res(offsets.back());
+
+  details::for_each_chunk(n, k, [&](std::size_t c, std::size_t begin, std::size_t end) {
+    std::size_t out = offsets[c];
+    for (std::size_t i = begin; i < end; ++i)
+    {
+      if (selected[i])
+        res[out++] = fun(vec[i]);
+    }
+  });
+
+  if constexpr (std::is_same<R, bool>::value)
+    return std::vector<R>(res.begin(), res.end());
+  else
+    return res;
+}
+
+namespace details
+{
+
+/**
+ * \brief hints the CPU that the memory at \a addr will soon be read
+ */
+inline void prefetch_address(const void* addr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(addr);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  _mm_prefetch(static_cast<const char*>(addr), _MM_HINT_T0);
+#else
+  (void)addr;
+#endif
+}
+
+// returns the address of the object a pointer-like element points to
+template<typename T>
+const void* pointee(T* ptr) { return ptr; }
+
+template<typename T, typename D>
+const void* pointee(const std::unique_ptr<T, D>& ptr) { return ptr.get(); }
+
+template<typename T>
+const void* pointee(const std::shared_ptr<T>& ptr) { return ptr.get(); }
+
+} // namespace details
+
+/**
+ * \brief tag used to select the prefetching overload of map()
+ *
+ * \a distance is the number of elements ahead of the current one whose
+ * pointee is prefetched. It should roughly cover the latency of a cache
+ * miss divided by the time spent in the functor for one element.
+ */
+struct prefetch_t
+{
+  std::size_t distance = 8;
+};
+
+inline prefetch_t prefetch(std::size_t distance = 8)
+{
+  return prefetch_t{ distance };
+}
+
+/**
+ * \brief a map() function for vectors of pointers
+ * \param opts  prefetching options
+ * \param vec  input vector of raw or smart pointers
+ * \param fun  function to apply to each element
+ *
+ * Same as map(), but while \a fun processes the i-th element, the object
+ * pointed to by the (i + opts.distance)-th element is prefetched.
+ * When the pointees are scattered in memory and \a fun dereferences its
+ * argument, this overlaps the cache misses instead of paying for them
+ * one after the other.
+ *
+ * \note there is no point using this for functors that do not dereference
+ * the pointers (e.g. rawpointers()).
+ */
+template<typename T, typename F, typename R = typename std::invoke_result<F, T>::type>
+std::vector<R> map(prefetch_t opts, const std::vector<T>& vec, F&& fun)
+{
+  const std::size_t n = vec.size();
+  const std::size_t d = std::min(opts.distance, n);
+
+  std::vector<R> res;
+  res.reserve(n);
+
+  for (std::size_t i = 0; i < d; ++i)
+    details::prefetch_address(details::pointee(vec[i]));
+
+  for (std::size_t i = 0; i + d < n; ++i)
+  {
+    details::prefetch_address(details::pointee(vec[i + d]));
+    res.push_back(fun(vec[i]));
+  }
+
+  for (std::size_t i = n - d; i < n; ++i)
+    res.push_back(fun(vec[i]));
+
+  return res;
+}
+
+/**
+ * \brief options of map_stream()
+ */
+struct stream_options
+{
+  std::size_t workers = std::max(1u, std::thread::hardware_concurrency()); ///< number of worker threads
+  std::size_t capacity = 64; ///< max number of elements read but not yet consumed
+};
+
+/**
+ * \brief counters reported by map_stream()
+ *
+ * Latency is measured from the moment an element is read from the
+ * source to the moment its image is handed to the sink, so it includes
+ * the time spent waiting in the reorder buffer.
+ */
+struct stream_stats
+{
+  std::size_t count = 0; ///< number of elements processed
+  std::chrono::nanoseconds elapsed{ 0 }; ///< wall-clock time of the whole stream
+  std::chrono::nanoseconds total_latency{ 0 };
+  std::chrono::nanoseconds max_latency{ 0 };
+
+  double throughput() const
+  {
+    return elapsed.count() > 0 ? count / std::chrono::duration<double>(elapsed).count() : 0.0;
+  }
+
+  std::chrono::nanoseconds mean_latency() const
+  {
+    return count > 0 ? total_latency / static_cast<std::chrono::nanoseconds::rep>(count) : std::chrono::nanoseconds{ 0 };
+  }
+};
+
+/**
+ * \brief a map() function for unbounded streams
+ * \tparam Source  callable returning a std::optional<T>, std::nullopt meaning end of stream
+ * \tparam F  functor-like type
+ * \tparam Sink  callable accepting the transformed elements
+ * \param source  produces the input elements
+ * \param fun  function to apply to each element
+ * \param sink  consumes the output elements, in input order
+ * \param opts  number of workers and size of the reorder buffer
+ * \return throughput and latency counters
+ *
+ * Elements are read from \a source and transformed by \a fun on
+ * opts.workers threads; \a sink is called on the calling thread.
+ * Since workers may finish out of order, results go through a reorder
+ * buffer of opts.capacity slots. The buffer also provides backpressure:
+ * once opts.capacity elements are in flight, workers stop reading from
+ * \a source until \a sink has caught up.
+ *
+ * \a source is never called concurrently, \a fun may be.
+ * If any of the callables throws, the stream is stopped and the first
+ * exception is rethrown once all workers have been joined.
+ */
+template<typename Source, typename F, typename Sink>
+stream_stats map_stream(Source&& source, F&& fun, Sink&& sink, stream_options opts = {})
+{
+  using T = typename std::invoke_result<Source&>::type::value_type;
+  using R = typename std::invoke_result<F&, T>::type;
+  using clock = std::chrono::steady_clock;
+
+  struct Slot
+  {
+    std::optional<R> value;
+    clock::time_point read_time;
+  };
+
+  const std::size_t capacity = std::max<std::size_t>(1, opts.capacity);
+  std::vector<Slot> slots(capacity);
+
+  std::mutex mutex;
+  std::condition_variable space_available;
+  std::condition_variable result_available;
+  std::size_t in_flight = 0; // slots reserved by workers and not yet consumed
+  std::size_t next_emit = 0;
+  std::optional<std::size_t> end_of_stream;
+  bool stopped = false;
+  std::exception_ptr error;
+
+  std::mutex source_mutex;
+  std::size_t next_read = 0;
+  bool source_exhausted = false;
+
+  auto stop = [&](std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (!error)
+      error = e;
+    stopped = true;
+    space_available.notify_all();
+    result_available.notify_all();
+  };
+
+  auto work = [&]() {
+    try
+    {
+      for (;;)
+      {
+        {
+          std::unique_lock<std::mutex> lock{ mutex };
+          space_available.wait(lock, [&]() { return stopped || end_of_stream || in_flight < capacity; });
+          if (stopped || end_of_stream)
+            return;
+          ++in_flight;
+        }
+
+        std::optional<T> item;
+        std::size_t seq;
+        clock::time_point read_time;
+
+        {
+          std::lock_guard<std::mutex> lock{ source_mutex };
+          if (!source_exhausted)
+            item = source();
+          source_exhausted = !item;
+          seq = item ? next_read++ : next_read;
+          read_time = clock::now();
+        }
+
+        if (!item)
+        {
+          // 'seq' is the total number of elements in the stream
+          std::lock_guard<std::mutex> lock{ mutex };
+          --in_flight;
+          end_of_stream = seq;
+          space_available.notify_all();
+          result_available.notify_all();
+          return;
+        }
+
+        R result = fun(std::move(*item));
+
+        std::lock_guard<std::mutex> lock{ mutex };
+        Slot& slot = slots[seq % capacity];
+        slot.value.emplace(std::move(result));
+        slot.read_time = read_time;
+        if (seq == next_emit)
+          result_available.notify_one();
+      }
+    }
+    catch (...)
+    {
+      stop(std::current_exception());
+    }
+  };
+
+  stream_stats stats;
+  const clock::time_point start = clock::now();
+
+  std::vector<std::thread> workers;
+  workers.reserve(opts.workers);
+  for (std::size_t i = 0; i < std::max<std::size_t>(1, opts.workers); ++i)
+    workers.emplace_back(work);
+
+  try
+  {
+    for (;;)
+    {
+      Slot slot;
+
+      {
+        std::unique_lock<std::mutex> lock{ mutex };
+        Slot& next = slots[next_emit % capacity];
+        result_available.wait(lock, [&]() {
+          return stopped || next.value || (end_of_stream && next_emit == *end_of_stream);
+        });
+        if (stopped || !next.value)
+          break;
+        slot = std::move(next);
+        next.value.reset();
+        ++next_emit;
+        --in_flight;
+      }
+
+      space_available.notify_one();
+
+      sink(std::move(*slot.value));
+
+      const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - slot.read_time);
+      stats.count += 1;
+      stats.total_latency += latency;
+      stats.max_latency = std::max(stats.max_latency, latency);
+    }
+  }
+  catch (...)
+  {
+    stop(std::current_exception());
+  }
+
+  for (std::thread& t : workers)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+
+  stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+  return stats;
+}
+
+/**
+ * \brief returns a map_stream() source reading values of type T from a stream
+ *
+ * The stream must outlive the source.
+ */
+template<typename T>
+auto istream_source(std::istream& stream)
+{
+  return [&stream]() -> std::optional<T> {
+    T value;
+    if (stream >> value)
+      return value;
+    return std::nullopt;
+  };
+}
+
+/**
+ * \brief returns a map_stream() sink writing one value per line to a stream
+ *
+ * The stream must outlive the sink.
+ */
+inline auto ostream_sink(std::ostream& stream)
+{
+  return [&stream](const auto& value) { stream << value << '\n'; };
+}
+
 /**
  * \brief converts a vector of shared pointer to raw pointers
  * \tparam T  type of the element that is pointed to
@@ -95,6 +757,18 @@ private:
   std::vector<std::unique_ptr<Lane>> m_lanes;
 };
 
+// Times run(), which returns the mapped vector, and prints the time per element.
+template<typename F>
+auto benchmark(const char* name, F&& run)
+{
+  auto start = std::chrono::steady_clock::now();
+  auto values = run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count() / values.size();
+  std::cout << name << ": " << ns << " ns/element" << std::endl;
+  return values;
+}
+
 int main()
 {
   std::cout << "Hello World!" << std::endl;
@@ -129,5 +803,129 @@ int main()
 
   std::cout << std::endl;
 
+  // Same thing, but computed by the compiler.
+  constexpr std::array<int, 5> integers_table{1, 2, 3, 4, 5};
+  constexpr auto squares_table = map(integers_table, [](int n) { return n * n; });
+  static_assert(squares_table.size() == 5, "map() preserves the size");
+  static_assert(squares_table[0] == 1 && squares_table[1] == 4 && squares_table[2] == 9
+    && squares_table[3] == 16 && squares_table[4] == 25, "squares computed at compile time");
+
+  for(int i : squares_table)
+  {
+    std::cout << i << " ";
+  }
+
+  std::cout << std::endl;
+
+  // Square only the odd numbers, without a temporary vector.
+  auto odd_squares = filter_map(integers, [](int n) { return n % 2 == 1; }, [](int n) { return n * n; });
+
+  for(int i : odd_squares)
+  {
+    std::cout << i << " ";
+  }
+
+  std::cout << std::endl;
+
+  // Results can be allocated from a caller-provided arena.
+  {
+    std::array<std::byte, 1024> buffer;
+    std::pmr::monotonic_buffer_resource arena{ buffer.data(), buffer.size() };
+    std::pmr::vector<int> cubes = map(integers, [](int n) { return n * n * n; }, &arena);
+    std::pmr::vector<std::pmr::string> labels = map(cubes, [](int n) { return std::pmr::string(std::to_string(n)); }, cubes.get_allocator());
+
+    for(const auto& s : labels)
+    {
+      std::cout << s << " ";
+    }
+
+    std::cout << std::endl;
+  }
+
+  // Prefetching the pointees hides part of the latency of pointer chasing.
+  {
+    struct Payload
+    {
+      int value;
+      char padding[60];
+    };
+
+    std::vector<std::unique_ptr<Payload>> payloads;
+    for(int i = 0; i < (1 << 20); ++i)
+    {
+      payloads.push_back(std::make_unique<Payload>());
+      payloads.back()->value = i;
+    }
+
+    // Visit the pointees in random order, as if they had been allocated randomly.
+    std::shuffle(payloads.begin(), payloads.end(), std::mt19937{ 42 });
+
+    auto read_value = [](const std::unique_ptr<Payload>& p) { return p->value; };
+
+    auto expected = benchmark("map()", [&]() { return map(payloads, read_value); });
+
+    for(std::size_t distance : {4, 8, 16, 32})
+    {
+      std::string name = "map(prefetch(" + std::to_string(distance) + "))";
+      auto values = benchmark(name.c_str(), [&]() { return map(prefetch(distance), payloads, read_value); });
+      if(values != expected)
+        std::cout << "--> NOT ok :(" << std::endl;
+    }
+  }
+
+  // Streams are mapped by several workers, but consumed in order.
+  {
+    std::istringstream file{ "1 2 3 4 5 6 7 8 9 10" };
+    map_stream(istream_source<int>(file), [](int n) { return n * n; }, ostream_sink(std::cout), stream_options{ 4, 4 });
+
+    // A "socket" that keeps producing numbers.
+    int received = 0;
+    auto socket = [&received]() -> std::optional<int> {
+      if (received == 100000)
+        return std::nullopt;
+      return received++;
+    };
+
+    int expected_next = 0;
+    bool in_order = true;
+    stream_stats stats = map_stream(socket, [](int n) { return std::to_string(n); }, [&](const std::string& s) {
+      in_order = in_order && std::stoi(s) == expected_next++;
+    });
+
+    std::cout << "map_stream(): " << stats.count << " elements " << (in_order ? "in order" : "OUT OF ORDER")
+      << ", " << stats.throughput() << " elements/s, mean latency " << stats.mean_latency().count()
+      << " ns, max latency " << stats.max_latency.count() << " ns" << std::endl;
+  }
+
+  // A functor hidden behind std::function is called once per block
+  // instead of once per element.
+  {
+    std::vector<int> many(1 << 22);
+    std::iota(many.begin(), many.end(), 0);
+
+    std::function<int(int)> per_element = [](int n) { return 3 * n + 1; };
+    std::function<void(span<const int>, span<int>)> per_block = [](span<const int> in, span<int> out) {
+      for (std::size_t i = 0; i < in.size(); ++i)
+        out[i] = 3 * in[i] + 1;
+    };
+
+    auto expected = benchmark("map(std::function<int(int)>)", [&]() { return map(many, per_element); });
+    auto values = benchmark("map(std::function<void(span<const int>, span<int>)>)", [&]() { return map(many, per_block); });
+    if (values != expected)
+      std::cout << "--> NOT ok :(" << std::endl;
+  }
+
+  // The parallel version gives the same result.
+  {
+    std::vector<int> many(1 << 20);
+    std::iota(many.begin(), many.end(), 0);
+    auto is_multiple_of_3 = [](int n) { return n % 3 == 0; };
+    auto halve = [](int n) { return n / 2; };
+    bool same = filter_map(many, is_multiple_of_3, halve) == filter_map(parallel, many, is_multiple_of_3, halve);
+    auto is_odd = [](int n) { return n % 2 != 0; };
+    same = same && filter_map(many, is_multiple_of_3, is_odd) == filter_map(parallel, many, is_multiple_of_3, is_odd);
+    std::cout << "filter_map(parallel, ...) " << (same ? "agrees" : "DISAGREES") << std::endl;
+  }
+
   return 0;
 }
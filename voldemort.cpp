@@ -1,8 +1,28 @@
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
 
 struct DeathlyHallows
 {
@@ -25,6 +45,100 @@ std::ostream& operator<<(std::ostream& stream, const DeathlyHallows& hallows)
   return stream;
 }
 
+// The same three flags, packed into a single byte.
+class PackedHallows
+{
+public:
+  enum Flag : std::uint8_t
+  {
+    ElderWand = 1,
+    ResurrectionStone = 2,
+    InvisibilityCloak = 4,
+  };
+
+  constexpr PackedHallows() = default;
+  constexpr explicit PackedHallows(std::uint8_t bits) : m_bits(bits & 7) { }
+
+  constexpr PackedHallows(const DeathlyHallows& hallows)
+    : m_bits((hallows.elder_wand ? ElderWand : 0) | (hallows.resurrection_stone ? ResurrectionStone : 0) |
+             (hallows.invisibility_cloak ? InvisibilityCloak : 0))
+  {
+  }
+
+  constexpr bool test(Flag flag) const { return m_bits & flag; }
+
+  void set(Flag flag, bool value = true)
+  {
+    m_bits = value ? (m_bits | flag) : (m_bits & ~flag);
+  }
+
+  constexpr std::uint8_t bits() const { return m_bits; }
+
+  constexpr DeathlyHallows unpack() const
+  {
+    return DeathlyHallows{ test(ElderWand), test(ResurrectionStone), test(InvisibilityCloak) };
+  }
+
+private:
+  std::uint8_t m_bits = 0;
+};
+
+// Formats records the same way as operator<<(), but into a caller-provided 
+// buffer and without allocating anything.
+// Since there are only 8 possible records, all of the same length, 
+// formatting one is a copy of a pre-rendered line.
+namespace hallows_format
+{
+
+constexpr std::string_view line_template = "[ ] ElderWand    [ ] Resurrection Stone    [ ] Invisibility Cloak";
+constexpr size_t size = line_template.size(); // length of a formatted record
+
+// The lines, each followed by a '\n'.
+inline const std::array<std::array<char, size + 1>, 8>& lines()
+{
+  static const auto table = []() {
+    constexpr size_t checkbox[] = { 1, 1 + line_template.find("[ ] Resurrection"),
+                                    1 + line_template.find("[ ] Invisibility") };
+    std::array<std::array<char, size + 1>, 8> result;
+    for (size_t bits = 0; bits < 8; ++bits)
+    {
+      std::copy(line_template.begin(), line_template.end(), result[bits].begin());
+      for (size_t flag = 0; flag < 3; ++flag)
+        result[bits][checkbox[flag]] = (bits >> flag) & 1 ? 'x' : ' ';
+      result[bits][size] = '\n';
+    }
+    return result;
+  }();
+
+  return table;
+}
+
+// Writes the record in [out, out + size) and returns out + size.
+inline char* format_to(char* out, PackedHallows hallows)
+{
+  std::memcpy(out, lines()[hallows.bits()].data(), size);
+  return out + size;
+}
+
+// Writes the records, one per line, starting at 'out' which must have room 
+// for (last - first) * (size + 1) chars; returns the end of the output.
+inline char* format_lines_to(char* out, const PackedHallows* first, const PackedHallows* last)
+{
+  const auto& table = lines();
+  for (; first != last; ++first, out += size + 1)
+    std::memcpy(out, table[first->bits()].data(), size + 1);
+  return out;
+}
+
+} // namespace hallows_format
+
+std::ostream& operator<<(std::ostream& stream, PackedHallows hallows)
+{
+  char buffer[hallows_format::size];
+  hallows_format::format_to(buffer, hallows);
+  return stream.write(buffer, sizeof(buffer));
+}
+
 auto he_who_must_not_be_named()
 {
   // C++ authorizes the definition of a class inside a function.
@@ -55,6 +169,36 @@ int main()
 
   void factory_with_voldemort_types();
   factory_with_voldemort_types();
+
+  void factory_with_flat_registry();
+  factory_with_flat_registry();
+
+  void factory_with_static_dispatch();
+  factory_with_static_dispatch();
+
+  void factory_with_pooled_products();
+  factory_with_pooled_products();
+
+  void factory_with_batches();
+  factory_with_batches();
+
+  void factory_with_concurrent_registry();
+  factory_with_concurrent_registry();
+
+  void fast_type_identification();
+  fast_type_identification();
+
+  void factory_with_lazy_registration();
+  factory_with_lazy_registration();
+
+  void factory_with_instrumentation();
+  factory_with_instrumentation();
+
+  void format_packed_hallows();
+  format_packed_hallows();
+
+  void factory_with_prototypes();
+  factory_with_prototypes();
 }
 
 
@@ -63,36 +207,505 @@ int main()
 // here http://videocortex.io/2017/Bestiary/#-voldemort-types).
 // Read more about the factory design pattern: https://refactoring.guru/design-patterns/factory-method
 
+// Describes a class of the Product hierarchy, for the purpose of fast 
+// type identification.
+// Each type gets a compact id and stores its "display" (see Cohen, 1991): 
+// the ids of its ancestors indexed by depth, itself included. An object of dynamic type D 
+// is a T if and only if D is at least as deep as T and D's ancestor at 
+// T's depth is T; which takes two integer compares instead of a walk 
+// of the hierarchy by dynamic_cast.
+struct ProductType
+{
+  std::uint32_t id; // compact id, in order of first use
+  size_t depth;
+  std::vector<std::uint32_t> display; // ids of the ancestors
+
+  static std::uint32_t next_id()
+  {
+    static std::atomic<std::uint32_t> counter{ 0 };
+    return counter++;
+  }
+};
+
 class Product
 {
 public:
+  Product() = default;
+  // The type belongs to the object being constructed or assigned, not to 
+  // the source (which may be of a more derived class when slicing).
+  Product(const Product&) { }
+  Product(Product&&) noexcept { }
   virtual ~Product() = default;
+
+  Product& operator=(const Product&) { return *this; }
+  Product& operator=(Product&&) noexcept { return *this; }
+
+  // Returns the type of the most-derived tagged class of this object, 
+  // or nullptr if the object is not tagged.
+  const ProductType* type() const { return m_type; }
+
+protected:
+  const ProductType* m_type = nullptr;
+};
+
+template<typename Derived, typename Base>
+class TaggedProduct;
+
+// A class opts in to fast type identification by deriving from 
+// TaggedProduct<Self, Base> instead of Base.
+template<typename T, typename = void>
+struct is_tagged_product : std::false_type { };
+
+template<typename T>
+struct is_tagged_product<T, std::void_t<typename T::tagged_base>>
+  : std::is_base_of<TaggedProduct<T, typename T::tagged_base>, T> { };
+
+template<typename T>
+const ProductType& product_type()
+{
+  static_assert(std::is_same<T, Product>::value || is_tagged_product<T>::value, "T must be a tagged product");
+
+  static const ProductType type = []() {
+    ProductType result{ ProductType::next_id(), 0, {} };
+    if constexpr (!std::is_same<T, Product>::value)
+    {
+      const ProductType& base = product_type<typename T::tagged_base>();
+      result.depth = base.depth + 1;
+      result.display = base.display;
+    }
+    result.display.push_back(result.id);
+    return result;
+  }();
+
+  return type;
+}
+
+template<typename Derived, typename Base = Product>
+class TaggedProduct : public Base
+{
+public:
+  using tagged_base = Base;
+
+  template<typename... Args>
+  TaggedProduct(Args&&... args) : Base(std::forward<Args>(args)...)
+  {
+    this->m_type = &product_type<Derived>();
+  }
+
+  TaggedProduct(const TaggedProduct& other) : Base(other)
+  {
+    this->m_type = &product_type<Derived>();
+  }
+
+  TaggedProduct(TaggedProduct&& other) noexcept(std::is_nothrow_move_constructible<Base>::value)
+    : Base(std::move(other))
+  {
+    this->m_type = &product_type<Derived>();
+  }
+
+  TaggedProduct& operator=(const TaggedProduct&) = default;
+  TaggedProduct& operator=(TaggedProduct&&) = default;
+};
+
+// Returns whether 'p' points to a T.
+// O(1) if T is a tagged product, falls back to dynamic_cast otherwise.
+template<typename T>
+bool is(const Product* p)
+{
+  if constexpr (std::is_same<T, Product>::value)
+  {
+    return p != nullptr;
+  }
+  else if constexpr (is_tagged_product<T>::value)
+  {
+    // An object that derives from a tagged class is tagged.
+    if (!p || !p->type()) return false;
+    const ProductType& target = product_type<T>();
+    const ProductType& actual = *p->type();
+    return actual.depth >= target.depth && actual.display[target.depth] == target.id;
+  }
+  else
+  {
+    return dynamic_cast<const T*>(p) != nullptr;
+  }
+}
+
+// Same as dynamic_cast<T*>(p), but O(1) if T is a tagged product.
+template<typename T>
+T* as(Product* p)
+{
+  if constexpr (is_tagged_product<T>::value)
+    return is<T>(p) ? static_cast<T*>(p) : nullptr;
+  else
+    return dynamic_cast<T*>(p);
+}
+
+template<typename T>
+const T* as(const Product* p)
+{
+  return as<T>(const_cast<Product*>(p));
+}
+
+class Car : public TaggedProduct<Car>
+{
+public:
+  static constexpr std::string_view kind = "car";
+};
+
+class Truck : public TaggedProduct<Truck>
+{
+public:
+  static constexpr std::string_view kind = "truck";
+};
+
+// Products used to be returned as raw pointers that nobody freed, each one 
+// being a separate trip to the global allocator.
+// They are now returned as a ProductHandle, a std::unique_ptr whose deleter 
+// knows how to give the memory back to where it came from; typically an 
+// ObjectPool.
+
+struct ProductDeleter
+{
+  static void default_release(Product* p) { delete p; }
+
+  void (*release)(Product*) = &default_release;
+
+  void operator()(Product* p) const { release(p); }
+};
+
+using ProductHandle = std::unique_ptr<Product, ProductDeleter>;
+
+// A pool of fixed-size blocks for objects of type T.
+// Each thread allocates from, and releases to, its own cache of free blocks 
+// so that creation and destruction are O(1) and do not need any lock.
+// Caches are refilled from (and overflow to) a shared free list, itself 
+// fed by large slabs; only these rare exchanges take a lock.
+// Blocks may be released by a different thread than the one that 
+// allocated them.
+// Slabs are never returned to the system, which allows objects to outlive 
+// the thread that created them.
+template<typename T>
+class ObjectPool
+{
+public:
+  static constexpr size_t blocks_per_slab = 256;
+
+  template<typename... Args>
+  static T* create(Args&&... args)
+  {
+    void* block = allocate();
+    try
+    {
+      return new (block) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+      deallocate(block);
+      throw;
+    }
+  }
+
+  static void destroy(T* object)
+  {
+    object->~T();
+    deallocate(object);
+  }
+
+  // Returns the number of objects currently alive in the pool.
+  // Nothing is counted on creation or destruction: live objects are the 
+  // blocks of the slabs that are neither in the shared free list nor in 
+  // the cache of a thread, whose sizes are maintained anyway.
+  static std::int64_t live()
+  {
+    Shared& s = shared();
+    std::lock_guard<std::mutex> lock{ s.mutex };
+    std::int64_t result = static_cast<std::int64_t>(s.slabs.size() * blocks_per_slab - s.free_count);
+    for (const Cache* c : s.caches)
+      result -= static_cast<std::int64_t>(c->count.load(std::memory_order_relaxed));
+    return result;
+  }
+
+private:
+  union Block
+  {
+    Block* next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  struct Cache;
+
+  struct Shared
+  {
+    std::mutex mutex;
+    Block* free_list = nullptr;
+    size_t free_count = 0;
+    std::vector<std::unique_ptr<Block[]>> slabs;
+    std::vector<const Cache*> caches; // that ever held blocks, of the running threads
+  };
+
+  struct Cache
+  {
+    Block* head = nullptr;
+    // Only written by the owning thread; atomic so that live() can read it.
+    std::atomic<size_t> count{ 0 };
+    bool registered = false;
+
+    ~Cache()
+    {
+      while (head)
+        give_back(*this, count.load(std::memory_order_relaxed));
+
+      if (registered)
+      {
+        Shared& s = shared();
+        std::lock_guard<std::mutex> lock{ s.mutex };
+        s.caches.erase(std::find(s.caches.begin(), s.caches.end(), this));
+      }
+    }
+
+    void add_count(std::ptrdiff_t n)
+    {
+      count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+  };
+
+  static Shared& shared()
+  {
+    // Intentionally leaked: handles may be released during static destruction.
+    static Shared* instance = new Shared;
+    return *instance;
+  }
+
+  static Cache& cache()
+  {
+    thread_local Cache instance;
+    return instance;
+  }
+
+  static void* allocate()
+  {
+    Cache& c = cache();
+    if (!c.head) refill(c);
+    Block* b = c.head;
+    c.head = b->next;
+    c.add_count(-1);
+    return b->storage;
+  }
+
+  static void deallocate(void* ptr)
+  {
+    Cache& c = cache();
+    if (!c.registered)
+    {
+      // a thread that only releases objects still caches their blocks
+      Shared& s = shared();
+      std::lock_guard<std::mutex> lock{ s.mutex };
+      register_cache(s, c);
+    }
+    Block* b = reinterpret_cast<Block*>(ptr);
+    b->next = c.head;
+    c.head = b;
+    c.add_count(1);
+    if (c.count.load(std::memory_order_relaxed) > 2 * blocks_per_slab) give_back(c, blocks_per_slab);
+  }
+
+  static void refill(Cache& c)
+  {
+    Shared& s = shared();
+    std::lock_guard<std::mutex> lock{ s.mutex };
+
+    // the lock is taken anyway, so this is where live() learns about the thread
+    register_cache(s, c);
+
+    if (!s.free_list)
+    {
+      s.slabs.push_back(std::make_unique<Block[]>(blocks_per_slab));
+      Block* slab = s.slabs.back().get();
+      for (size_t i = 0; i < blocks_per_slab; ++i)
+        slab[i].next = i + 1 < blocks_per_slab ? slab + i + 1 : s.free_list;
+      s.free_list = slab;
+      s.free_count += blocks_per_slab;
+    }
+
+    // take up to one slab worth of blocks
+    for (size_t i = 0; i < blocks_per_slab && s.free_list; ++i)
+    {
+      Block* b = s.free_list;
+      s.free_list = b->next;
+      --s.free_count;
+      b->next = c.head;
+      c.head = b;
+      c.add_count(1);
+    }
+  }
+
+  // Lets live() see the blocks of 'c'; must be called with the lock held, 
+  // before 'c' holds any block.
+  static void register_cache(Shared& s, Cache& c)
+  {
+    if (!c.registered)
+    {
+      s.caches.push_back(&c);
+      c.registered = true;
+    }
+  }
+
+  static void give_back(Cache& c, size_t n)
+  {
+    Shared& s = shared();
+    std::lock_guard<std::mutex> lock{ s.mutex };
+
+    for (size_t i = 0; i < n && c.head; ++i)
+    {
+      Block* b = c.head;
+      c.head = b->next;
+      c.add_count(-1);
+      b->next = s.free_list;
+      s.free_list = b;
+      ++s.free_count;
+    }
+  }
 };
 
-class Car : public Product { };
+// Creates a T in its ObjectPool and returns an owning handle to it.
+template<typename T, typename... Args>
+ProductHandle make_pooled(Args&&... args)
+{
+  T* object = ObjectPool<T>::create(std::forward<Args>(args)...);
+  auto release = [](Product* p) { ObjectPool<T>::destroy(static_cast<T*>(p)); };
+  return ProductHandle(object, ProductDeleter{ release });
+}
+
+// A batch of products of the same type, constructed contiguously in 
+// a single allocation and destroyed together.
+// Products are accessed through their Product base.
+class ProductBatch
+{
+public:
+  class iterator
+  {
+  public:
+    iterator(unsigned char* ptr, size_t stride) : m_ptr(ptr), m_stride(stride) { }
+
+    Product& operator*() const { return *reinterpret_cast<Product*>(m_ptr); }
+    Product* operator->() const { return reinterpret_cast<Product*>(m_ptr); }
+    iterator& operator++() { m_ptr += m_stride; return *this; }
+    bool operator==(const iterator& other) const { return m_ptr == other.m_ptr; }
+    bool operator!=(const iterator& other) const { return m_ptr != other.m_ptr; }
+
+  private:
+    unsigned char* m_ptr;
+    size_t m_stride;
+  };
+
+  ProductBatch() = default;
+
+  ProductBatch(ProductBatch&& other) noexcept
+    : m_first(std::exchange(other.m_first, nullptr)), m_size(std::exchange(other.m_size, 0)),
+      m_stride(other.m_stride), m_release(other.m_release)
+  {
+  }
+
+  ProductBatch& operator=(ProductBatch&& other) noexcept
+  {
+    ProductBatch tmp{ std::move(other) };
+    std::swap(m_first, tmp.m_first);
+    std::swap(m_size, tmp.m_size);
+    std::swap(m_stride, tmp.m_stride);
+    std::swap(m_release, tmp.m_release);
+    return *this;
+  }
+
+  ~ProductBatch()
+  {
+    if (m_first) m_release(m_first, m_size);
+  }
+
+  // Constructs 'n' T, each one from 'args' (by copy).
+  template<typename T, typename... Args>
+  static ProductBatch create(size_t n, const Args&... args)
+  {
+    std::allocator<T> alloc;
+    T* objects = alloc.allocate(n);
+    size_t constructed = 0;
+
+    try
+    {
+      for (; constructed < n; ++constructed)
+        new (objects + constructed) T(args...);
+    }
+    catch (...)
+    {
+      release<T>(objects, constructed, n);
+      throw;
+    }
+
+    ProductBatch batch;
+    batch.m_first = objects;
+    batch.m_size = n;
+    batch.m_stride = sizeof(T);
+    batch.m_release = [](Product* first, size_t count) { release<T>(static_cast<T*>(first), count, count); };
+    return batch;
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  Product& operator[](size_t i) const { return *product_ptr(i); }
+
+  iterator begin() const { return iterator(bytes(), m_stride); }
+  iterator end() const { return iterator(bytes() + m_size * m_stride, m_stride); }
+
+private:
+  // T objects are destroyed in reverse order, like the elements of an array.
+  template<typename T>
+  static void release(T* objects, size_t count, size_t capacity)
+  {
+    while (count > 0)
+      objects[--count].~T();
+    std::allocator<T>().deallocate(objects, capacity);
+  }
+
+  unsigned char* bytes() const { return reinterpret_cast<unsigned char*>(m_first); }
+  Product* product_ptr(size_t i) const { return reinterpret_cast<Product*>(bytes() + i * m_stride); }
+
+private:
+  Product* m_first = nullptr;
+  size_t m_size = 0;
+  size_t m_stride = 0;
+  void (*m_release)(Product*, size_t) = nullptr;
+};
 
 class FactoryInterface
 {
 public:
   virtual ~FactoryInterface() = default;
-  virtual Product* getProduct() = 0;
+  virtual ProductHandle getProduct() = 0;
+  // Creates 'n' products at once: one virtual call and one allocation per batch.
+  virtual ProductBatch getProducts(size_t n) = 0;
 };
 
 using Factory = std::map<std::string, std::unique_ptr<FactoryInterface>>;
 
-void register_car_factory(Factory& factory)
+std::unique_ptr<FactoryInterface> make_car_factory()
 {
   // Since no one needs to know the actual class that creates cars,
   // we can use a voldemort type to considerably restrict access to the class.
   class CarFactory : public FactoryInterface
   {
-    Product* getProduct() override { return new Car; }
+    ProductHandle getProduct() override { return make_pooled<Car>(); }
+    ProductBatch getProducts(size_t n) override { return ProductBatch::create<Car>(n); }
   };
 
-  factory["car"] = std::make_unique<CarFactory>();
+  return std::make_unique<CarFactory>();
+}
+
+void register_car_factory(Factory& factory)
+{
+  factory["car"] = make_car_factory();
 }
 
-Product* build_car(Factory& factory)
+ProductHandle build_car(Factory& factory)
 {
   return factory.at("car")->getProduct();
 }
@@ -101,6 +714,1340 @@ void factory_with_voldemort_types()
 {   
   Factory factory; 
   register_car_factory(factory);
-  Product* p = build_car(factory);
-  std::cout << (dynamic_cast<Car*>(p) ? true : false) << std::endl;
+  ProductHandle p = build_car(factory);
+  std::cout << (dynamic_cast<Car*>(p.get()) ? true : false) << std::endl;
+}
+
+
+// With hundreds of kinds and millions of products per second, the std::map 
+// above becomes a bottleneck: every lookup constructs a std::string and 
+// performs O(log n) string comparisons.
+// FlatRegistry replaces it for that use case: keys are looked up as 
+// std::string_view in a flat open-addressing hash table, and once all kinds 
+// are registered, the table can be frozen into a perfect hash table where 
+// a lookup is one hash, one probe and one string comparison.
+// As with std::map, references to values stay valid when keys are added: 
+// entries live in a std::deque and the table only stores their indices.
+
+namespace registry_details
+{
+
+// 64-bit FNV-1a, followed by a finalizer so that all bits depend on all bits.
+constexpr std::uint64_t hash(std::string_view str, std::uint64_t seed = 0)
+{
+  std::uint64_t h = 14695981039346656037ull ^ (seed * 0x9E3779B97F4A7C15ull);
+  for (char c : str)
+  {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ull;
+  }
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+} // namespace registry_details
+
+template<typename V>
+class FlatRegistry
+{
+public:
+  struct Entry
+  {
+    std::string key;
+    V value;
+    std::uint64_t hash;
+  };
+
+  // Returns the value associated with 'key', inserting a default-constructed 
+  // value if there is none.
+  // Throws std::logic_error if the key is missing and the registry is frozen.
+  V& operator[](std::string_view key)
+  {
+    const std::uint64_t h = registry_details::hash(key);
+    if (V* v = find(key, h)) return *v;
+    if (frozen()) throw std::logic_error("FlatRegistry: cannot register new keys once frozen");
+    return insert(std::string(key), V(), h);
+  }
+
+  V* find(std::string_view key)
+  {
+    return find(key, registry_details::hash(key));
+  }
+
+  const V* find(std::string_view key) const
+  {
+    return const_cast<FlatRegistry*>(this)->find(key);
+  }
+
+  // Same as std::map::at(): throws std::out_of_range if the key is missing.
+  V& at(std::string_view key)
+  {
+    if (V* v = find(key)) return *v;
+    throw std::out_of_range("FlatRegistry::at");
+  }
+
+  const V& at(std::string_view key) const
+  {
+    return const_cast<FlatRegistry*>(this)->at(key);
+  }
+
+  size_t size() const { return m_entries.size(); }
+  const std::deque<Entry>& entries() const { return m_entries; }
+
+  bool frozen() const { return !m_perfect_slots.empty(); }
+
+  // Builds a minimal (or nearly so) perfect hash table over the current keys, 
+  // using the "hash, displace and compress" approach: keys are distributed 
+  // into small buckets, and for each bucket, largest first, we search a 
+  // displacement that sends all its keys to free slots.
+  // No keys can be added afterwards.
+  // Returns false, and leaves the registry usable but unfrozen, in the 
+  // unlikely case no perfect hash function was found.
+  bool freeze()
+  {
+    if (frozen() || m_entries.empty()) return frozen();
+
+    const size_t n = m_entries.size();
+    size_t m = n;
+
+    for (int attempt = 0; attempt < 8; ++attempt, m += m / 4 + 1)
+    {
+      if (build_perfect_table(m)) return true;
+    }
+
+    return false;
+  }
+
+private:
+  V& insert(std::string key, V value, std::uint64_t h)
+  {
+    if (2 * (m_entries.size() + 1) > m_slots.size())
+      rehash(std::max<size_t>(16, 2 * m_slots.size()));
+
+    m_entries.push_back(Entry{ std::move(key), std::move(value), h });
+    place(static_cast<std::uint32_t>(m_entries.size()));
+    return m_entries.back().value;
+  }
+
+  V* find(std::string_view key, std::uint64_t h)
+  {
+    if (frozen())
+    {
+      const std::uint32_t slot = perfect_slot(h, m_seeds[h % m_seeds.size()], m_perfect_slots.size());
+      const std::uint32_t index = m_perfect_slots[slot];
+      if (index == 0) return nullptr;
+      Entry& e = m_entries[index - 1];
+      return e.hash == h && e.key == key ? &e.value : nullptr;
+    }
+
+    if (m_slots.empty()) return nullptr;
+
+    const size_t mask = m_slots.size() - 1;
+
+    for (size_t i = h & mask; m_slots[i] != 0; i = (i + 1) & mask)
+    {
+      Entry& e = m_entries[m_slots[i] - 1];
+      if (e.hash == h && e.key == key) return &e.value;
+    }
+
+    return nullptr;
+  }
+
+  // 'index' is one plus the index of the entry in 'm_entries', 
+  // so that 0 can denote an empty slot.
+  void place(std::uint32_t index)
+  {
+    const size_t mask = m_slots.size() - 1;
+    size_t i = m_entries[index - 1].hash & mask;
+    while (m_slots[i] != 0)
+      i = (i + 1) & mask;
+    m_slots[i] = index;
+  }
+
+  void rehash(size_t capacity)
+  {
+    m_slots.assign(capacity, 0);
+    for (size_t i = 0; i < m_entries.size(); ++i)
+      place(static_cast<std::uint32_t>(i + 1));
+  }
+
+  // The displacement 'seed' of a bucket encodes a pair (d0, d1) and the 
+  // slot is f1 + d0 * f2 + d1 (mod m), where f1 and f2 are derived from 
+  // the hash of the key, so that each lookup only hashes the key once.
+  static std::uint32_t perfect_slot(std::uint64_t h, std::uint32_t seed, size_t m)
+  {
+    const std::uint64_t f1 = (h >> 32) % m;
+    const std::uint64_t f2 = (h >> 8) % m;
+    const std::uint64_t d0 = seed / m;
+    const std::uint64_t d1 = seed % m;
+    return static_cast<std::uint32_t>((f1 + d0 * f2 + d1) % m);
+  }
+
+  bool build_perfect_table(size_t m)
+  {
+    const size_t nb_buckets = std::max<size_t>(1, m_entries.size() / 4);
+
+    std::vector<std::vector<std::uint32_t>> buckets(nb_buckets);
+    for (size_t i = 0; i < m_entries.size(); ++i)
+      buckets[m_entries[i].hash % nb_buckets].push_back(static_cast<std::uint32_t>(i + 1));
+
+    std::vector<size_t> order(nb_buckets);
+    for (size_t b = 0; b < nb_buckets; ++b) order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<std::uint32_t> seeds(nb_buckets, 0);
+    std::vector<std::uint32_t> table(m, 0);
+    std::vector<std::uint32_t> candidate;
+
+    const std::uint64_t max_seed = std::min<std::uint64_t>(std::uint64_t(m) * m, 1u << 20);
+
+    for (size_t b : order)
+    {
+      const std::vector<std::uint32_t>& bucket = buckets[b];
+      if (bucket.empty()) break;
+
+      bool placed = false;
+
+      for (std::uint64_t seed = 0; seed < max_seed && !placed; ++seed)
+      {
+        candidate.clear();
+        placed = true;
+
+        for (std::uint32_t index : bucket)
+        {
+          std::uint32_t slot = perfect_slot(m_entries[index - 1].hash, static_cast<std::uint32_t>(seed), m);
+          if (table[slot] != 0 || std::find(candidate.begin(), candidate.end(), slot) != candidate.end())
+          {
+            placed = false;
+            break;
+          }
+          candidate.push_back(slot);
+        }
+
+        if (placed)
+        {
+          for (size_t i = 0; i < bucket.size(); ++i)
+            table[candidate[i]] = bucket[i];
+          seeds[b] = static_cast<std::uint32_t>(seed);
+        }
+      }
+
+      if (!placed) return false;
+    }
+
+    m_seeds = std::move(seeds);
+    m_perfect_slots = std::move(table);
+    m_slots.clear();
+    m_slots.shrink_to_fit();
+    return true;
+  }
+
+private:
+  std::deque<Entry> m_entries; // stable addresses, unlike std::vector
+  std::vector<std::uint32_t> m_slots; // open-addressing table, size is a power of two
+  std::vector<std::uint32_t> m_seeds; // displacement of each bucket, once frozen
+  std::vector<std::uint32_t> m_perfect_slots; // perfect hash table, once frozen
+};
+
+using FactoryRegistry = FlatRegistry<std::unique_ptr<FactoryInterface>>;
+
+void register_car_factory(FactoryRegistry& factory)
+{
+  factory["car"] = make_car_factory();
+}
+
+ProductHandle build_car(FactoryRegistry& factory)
+{
+  return factory.at("car")->getProduct();
+}
+
+// Creates 'n' products of the given kind with a single lookup.
+ProductBatch build_many(FactoryRegistry& factory, std::string_view kind, size_t n)
+{
+  return factory.at(kind)->getProducts(n);
+}
+
+void factory_with_flat_registry()
+{
+  FactoryRegistry factory;
+  register_car_factory(factory);
+  std::unique_ptr<FactoryInterface>* car_factory = factory.find("car");
+
+  // Register a few hundred other kinds...
+  for (int i = 0; i < 500; ++i)
+    factory["kind" + std::to_string(i)] = make_car_factory();
+
+  // ... and freeze the registry once registration is over.
+  bool frozen = factory.freeze();
+
+  ProductHandle p = build_car(factory);
+  bool all_found = factory.find("kind42") != nullptr && factory.find("kind499") != nullptr;
+  bool none_found = factory.find("kind500") == nullptr && factory.find("") == nullptr;
+  bool stable = factory.find("car") == car_factory;
+  std::cout << frozen << (dynamic_cast<Car*>(p.get()) ? true : false) << all_found << none_found << stable << std::endl;
+}
+
+
+// When the set of product kinds is known at build time, we don't need 
+// a registry of virtual factories at all. 
+// StaticFactory maps the compile-time keys of its products ('P::kind') to 
+// their index in a std::variant; products are created by value through a 
+// jump table and their type is recovered with std::get_if(), which only 
+// compares the index of the variant: no virtual call, no heap allocation 
+// and no RTTI.
+
+template<typename... Products>
+class StaticFactory
+{
+public:
+  using product_type = std::variant<Products...>;
+
+  static constexpr size_t npos = sizeof...(Products);
+
+  // Returns the index of the product whose kind is 'kind', or npos.
+  static constexpr size_t index_of(std::string_view kind)
+  {
+    constexpr std::array<std::string_view, sizeof...(Products)> kinds = { Products::kind... };
+    for (size_t i = 0; i < kinds.size(); ++i)
+    {
+      if (kinds[i] == kind) return i;
+    }
+    return npos;
+  }
+
+  // Creates the product at a compile-time index, e.g. create<index_of("car")>().
+  template<size_t I>
+  static product_type create()
+  {
+    static_assert(I < npos, "no such product");
+    return product_type(std::in_place_index<I>);
+  }
+
+  // Creates the product at a runtime index.
+  // Throws std::out_of_range if there is no such product.
+  static product_type create(size_t index)
+  {
+    if (index >= npos) throw std::out_of_range("StaticFactory::create");
+    return creators(std::index_sequence_for<Products...>())[index]();
+  }
+
+  static product_type create(std::string_view kind)
+  {
+    return create(index_of(kind));
+  }
+
+private:
+  using creator_type = product_type (*)();
+
+  template<size_t... I>
+  static const std::array<creator_type, npos>& creators(std::index_sequence<I...>)
+  {
+    static constexpr std::array<creator_type, npos> table = { &create<I>... };
+    return table;
+  }
+};
+
+using Vehicles = StaticFactory<Car, Truck>;
+
+// Runs 'fun' once and returns the elapsed time, counted in units of 'Duration'
+// (e.g. std::chrono::nanoseconds).
+template<typename Duration, typename F>
+double measure(F&& fun)
+{
+  auto start = std::chrono::steady_clock::now();
+  fun();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, typename Duration::period>(elapsed).count();
+}
+
+void factory_with_static_dispatch()
+{
+  static_assert(Vehicles::index_of("car") == 0 && Vehicles::index_of("truck") == 1, "");
+  static_assert(Vehicles::index_of("plane") == Vehicles::npos, "");
+
+  Vehicles::product_type p = Vehicles::create<Vehicles::index_of("car")>();
+  std::cout << (std::get_if<Car>(&p) ? true : false) << std::endl;
+
+  // Benchmark against a registry of virtual factories + dynamic_cast.
+  // Both sides look up the same kind, read through a volatile pointer so 
+  // that the compiler cannot resolve the lookups at compile time; what 
+  // differs is the hashed lookup, virtual call, pooled allocation and 
+  // dynamic_cast on one side, and the key comparisons, jump table and 
+  // std::get_if() on the other.
+  constexpr int N = 1000000;
+  const char* volatile kind_name = "car";
+
+  FactoryRegistry registry;
+  registry["car"] = make_car_factory();
+  registry.freeze();
+
+  int cars = 0;
+  double ns = measure<std::chrono::nanoseconds>([&]() {
+    for (int i = 0; i < N; ++i)
+    {
+      std::string_view kind = kind_name;
+      ProductHandle product = registry.at(kind)->getProduct();
+      cars += dynamic_cast<Car*>(product.get()) ? 1 : 0;
+    }
+  });
+  std::cout << "virtual + dynamic_cast: " << ns / N << " ns/product (" << cars << " cars)" << std::endl;
+
+  cars = 0;
+  ns = measure<std::chrono::nanoseconds>([&]() {
+    for (int i = 0; i < N; ++i)
+    {
+      std::string_view kind = kind_name;
+      Vehicles::product_type product = Vehicles::create(kind);
+      cars += std::get_if<Car>(&product) ? 1 : 0;
+    }
+  });
+  std::cout << "static dispatch: " << ns / N << " ns/product (" << cars << " cars)" << std::endl;
+}
+
+void factory_with_pooled_products()
+{
+  FactoryRegistry registry;
+  register_car_factory(registry);
+
+  // Handles can be released by another thread.
+  std::vector<ProductHandle> cars;
+  for (int i = 0; i < 1000; ++i)
+    cars.push_back(build_car(registry));
+  std::thread([&cars]() { cars.clear(); }).join();
+
+  constexpr int N = 1000000;
+
+  // Prevents the compiler from optimizing allocations away.
+  Product* volatile sink = nullptr;
+
+  double ns = measure<std::chrono::nanoseconds>([&sink]() {
+    for (int i = 0; i < N; ++i)
+    {
+      std::unique_ptr<Product> p{ new Car };
+      sink = p.get();
+    }
+  });
+  std::cout << "new + delete: " << ns / N << " ns/product" << std::endl;
+
+  ns = measure<std::chrono::nanoseconds>([&sink]() {
+    for (int i = 0; i < N; ++i)
+    {
+      ProductHandle p = make_pooled<Car>();
+      sink = p.get();
+    }
+  });
+  std::cout << "make_pooled(): " << ns / N << " ns/product" << std::endl;
+}
+
+void factory_with_batches()
+{
+  FactoryRegistry registry;
+  register_car_factory(registry);
+
+  ProductBatch cars = build_many(registry, "car", 3);
+  bool all_cars = true;
+  for (Product& p : cars)
+    all_cars = all_cars && dynamic_cast<Car*>(&p) != nullptr;
+  std::cout << cars.size() << all_cars << std::endl;
+
+  constexpr int N = 1000000;
+  constexpr int batch_size = 1000;
+
+  double ns = measure<std::chrono::nanoseconds>([&registry]() {
+    std::vector<ProductHandle> products;
+    products.reserve(batch_size);
+    for (int i = 0; i < N / batch_size; ++i)
+    {
+      products.clear();
+      for (int j = 0; j < batch_size; ++j)
+        products.push_back(build_car(registry));
+    }
+  });
+  std::cout << "build_car(): " << ns / N << " ns/product" << std::endl;
+
+  ns = measure<std::chrono::nanoseconds>([&registry]() {
+    for (int i = 0; i < N / batch_size; ++i)
+    {
+      ProductBatch products = build_many(registry, "car", batch_size);
+    }
+  });
+  std::cout << "build_many(): " << ns / N << " ns/product" << std::endl;
+}
+
+
+// Plugins may register new kinds at runtime while worker threads keep 
+// building products. A std::map would need a lock around every lookup.
+// ConcurrentFactoryRegistry uses RCU-style copy-on-write instead: readers 
+// only perform an atomic load of the current table, which is immutable; 
+// writers copy the table, modify the copy and publish it with an atomic 
+// store. Since readers may still be using the old table, it is not deleted 
+// right away but retired.
+// Retired tables (and replaced factories) are freed with epoch-based 
+// reclamation: each reader announces the global epoch when it starts 
+// a lookup, and each retired object is tagged with the epoch at which it 
+// was unpublished. Once every reader in progress has announced a later 
+// epoch, nobody can still see the object and it is freed.
+
+class EpochDomain
+{
+private:
+  // One per thread; records are reused by later threads but never freed.
+  struct Record
+  {
+    std::atomic<std::uint64_t> epoch{ 0 }; // 0 when not reading
+    std::atomic<bool> in_use{ true };
+    Record* next = nullptr;
+    int depth = 0; // only accessed by the owning thread
+  };
+
+public:
+  // Marks the calling thread as reading for the lifetime of the guard: 
+  // objects retired from now on are not freed until the guard is destroyed.
+  // Guards can be nested.
+  class Guard
+  {
+  public:
+    Guard() : m_record(local_record())
+    {
+      if (m_record->depth++ == 0)
+        m_record->epoch.store(global_epoch().load());
+    }
+
+    ~Guard()
+    {
+      if (--m_record->depth == 0)
+        m_record->epoch.store(0);
+    }
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+  private:
+    Record* m_record;
+  };
+
+  // To be called once an object is no longer reachable by new readers. 
+  // Returns the epoch to tag it with, and starts a new epoch.
+  static std::uint64_t retire()
+  {
+    return global_epoch().fetch_add(1);
+  }
+
+  // Objects tagged with an epoch lower than the returned value can be freed.
+  static std::uint64_t oldest_reader()
+  {
+    std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+    for (Record* r = records().load(); r; r = r->next)
+    {
+      const std::uint64_t epoch = r->epoch.load();
+      if (epoch != 0) oldest = std::min(oldest, epoch);
+    }
+    return oldest;
+  }
+
+private:
+  static std::atomic<std::uint64_t>& global_epoch()
+  {
+    static std::atomic<std::uint64_t> epoch{ 1 };
+    return epoch;
+  }
+
+  static std::atomic<Record*>& records()
+  {
+    static std::atomic<Record*> head{ nullptr };
+    return head;
+  }
+
+  static Record* local_record()
+  {
+    struct Owner
+    {
+      Record* record = acquire_record();
+      ~Owner() { record->in_use.store(false); }
+    };
+
+    thread_local Owner owner;
+    return owner.record;
+  }
+
+  static Record* acquire_record()
+  {
+    for (Record* r = records().load(); r; r = r->next)
+    {
+      bool in_use = false;
+      if (r->in_use.compare_exchange_strong(in_use, true)) return r;
+    }
+
+    Record* r = new Record; // intentionally leaked, see above
+    r->next = records().load();
+    while (!records().compare_exchange_weak(r->next, r)) { }
+    return r;
+  }
+};
+
+class ConcurrentFactoryRegistry
+{
+public:
+  using Table = FlatRegistry<FactoryInterface*>;
+
+  ConcurrentFactoryRegistry() : m_current(new Table) { }
+  ConcurrentFactoryRegistry(const ConcurrentFactoryRegistry&) = delete;
+  ConcurrentFactoryRegistry& operator=(const ConcurrentFactoryRegistry&) = delete;
+
+  ~ConcurrentFactoryRegistry()
+  {
+    delete m_current.load();
+  }
+
+  // Wait-free; may be called concurrently with insert().
+  // A factory that is replaced may be freed as soon as no lookup is in 
+  // progress: hold an EpochDomain::Guard for as long as the returned 
+  // pointer is used if factories can be replaced.
+  FactoryInterface* find(std::string_view key) const
+  {
+    EpochDomain::Guard guard;
+    const Table* table = m_current.load();
+    FactoryInterface* const* factory = table->find(key);
+    return factory ? *factory : nullptr;
+  }
+
+  // Throws std::out_of_range if the key is missing.
+  // Same caveat as find().
+  FactoryInterface& at(std::string_view key) const
+  {
+    if (FactoryInterface* factory = find(key)) return *factory;
+    throw std::out_of_range("ConcurrentFactoryRegistry::at");
+  }
+
+  // Creates a product with the factory for 'key', which cannot be freed 
+  // meanwhile even if it is replaced concurrently.
+  ProductHandle create(std::string_view key) const
+  {
+    EpochDomain::Guard guard;
+    return at(key).getProduct();
+  }
+
+  // Registers (or replaces) the factory for 'key'.
+  // Writers are serialized with each other but never block readers.
+  void insert(std::string_view key, std::unique_ptr<FactoryInterface> factory)
+  {
+    std::lock_guard<std::mutex> lock{ m_write_mutex };
+
+    const Table* old_table = m_current.load();
+    auto new_table = std::make_unique<Table>(*old_table);
+
+    Retired retired;
+    FactoryInterface*& slot = (*new_table)[key];
+    if (slot) retired.factory = release_factory(slot);
+    slot = factory.get();
+    m_factories.push_back(std::move(factory));
+
+    m_current.store(new_table.release());
+    retired.table.reset(old_table);
+    retired.epoch = EpochDomain::retire();
+    m_retired.push_back(std::move(retired));
+
+    collect();
+  }
+
+  // Frees the retired tables and factories that no reader can still use.
+  // Returns the number of those that must wait for readers to finish.
+  // Called by insert(); may be called at any time.
+  size_t reclaim()
+  {
+    std::lock_guard<std::mutex> lock{ m_write_mutex };
+    return collect();
+  }
+
+private:
+  struct Retired
+  {
+    std::uint64_t epoch = 0;
+    std::unique_ptr<const Table> table;
+    std::unique_ptr<FactoryInterface> factory;
+  };
+
+  size_t collect()
+  {
+    const std::uint64_t oldest = EpochDomain::oldest_reader();
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                   [oldest](const Retired& r) { return r.epoch < oldest; }),
+                    m_retired.end());
+    return m_retired.size();
+  }
+
+  std::unique_ptr<FactoryInterface> release_factory(FactoryInterface* factory)
+  {
+    auto it = std::find_if(m_factories.begin(), m_factories.end(),
+                           [factory](const std::unique_ptr<FactoryInterface>& f) { return f.get() == factory; });
+    std::unique_ptr<FactoryInterface> result = std::move(*it);
+    m_factories.erase(it);
+    return result;
+  }
+
+private:
+  std::atomic<const Table*> m_current;
+  std::mutex m_write_mutex;
+  std::vector<std::unique_ptr<FactoryInterface>> m_factories;
+  std::vector<Retired> m_retired;
+};
+
+void register_car_factory(ConcurrentFactoryRegistry& factory)
+{
+  factory.insert("car", make_car_factory());
+}
+
+ProductHandle build_car(const ConcurrentFactoryRegistry& factory)
+{
+  return factory.create("car");
+}
+
+void factory_with_concurrent_registry()
+{
+  ConcurrentFactoryRegistry registry;
+  register_car_factory(registry);
+
+  std::atomic<bool> done{ false };
+  std::atomic<int> cars{ 0 };
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; ++i)
+  {
+    workers.emplace_back([&]() {
+      while (!done.load())
+      {
+        ProductHandle p = build_car(registry);
+        cars += dynamic_cast<Car*>(p.get()) ? 1 : 0;
+      }
+    });
+  }
+
+  while (cars.load() == 0)
+    std::this_thread::yield();
+
+  // Meanwhile, plugins register their own kinds, and replace the car 
+  // factory that the workers are using.
+  // Old tables are freed as soon as the workers are done with them.
+  size_t max_pending = 0;
+  for (int i = 0; i < 200; ++i)
+  {
+    registry.insert("plugin" + std::to_string(i), make_car_factory());
+    if (i % 50 == 0) register_car_factory(registry);
+    max_pending = std::max(max_pending, registry.reclaim());
+    std::this_thread::yield();
+  }
+
+  done = true;
+  for (std::thread& t : workers)
+    t.join();
+
+  size_t pending = registry.reclaim();
+
+  std::cout << (cars > 0) << (registry.find("plugin199") != nullptr) << (pending == 0) << std::endl;
+  std::cout << "retired tables waiting for readers: at most " << max_pending << " out of 204" << std::endl;
+}
+
+class SportsCar : public TaggedProduct<SportsCar, Car> { };
+class Roadster : public TaggedProduct<Roadster, SportsCar> { };
+class Van : public Product { }; // not tagged
+
+void fast_type_identification()
+{
+  Roadster roadster;
+  Truck truck;
+  Van van;
+
+  std::cout << is<Car>(&roadster) << is<SportsCar>(&roadster) << is<Product>(&roadster)
+            << !is<Truck>(&roadster) << !is<Car>(&truck) << !is<Car>(&van) << is<Van>(&van)
+            << (as<Car>(&roadster) == &roadster) << (as<Roadster>(&truck) == nullptr) << std::endl;
+
+  // A sliced copy has the type of the copy, not of the source.
+  SportsCar sports_car;
+  Car sliced = sports_car;
+  Car assigned;
+  assigned = roadster;
+  std::cout << !is<SportsCar>(&sliced) << is<Car>(&sliced) << !is<Roadster>(&assigned) << is<Car>(&assigned)
+            << std::endl;
+
+  // Benchmark against dynamic_cast on a mix of products.
+  std::vector<ProductHandle> products;
+  for (int i = 0; i < 1000; ++i)
+  {
+    switch (i % 4)
+    {
+    case 0: products.push_back(make_pooled<Car>()); break;
+    case 1: products.push_back(make_pooled<Truck>()); break;
+    case 2: products.push_back(make_pooled<Roadster>()); break;
+    default: products.push_back(make_pooled<SportsCar>()); break;
+    }
+  }
+
+  constexpr int rounds = 1000;
+
+  auto benchmark = [&products](const char* name, auto&& is_car) {
+    size_t cars = 0;
+    double ns = measure<std::chrono::nanoseconds>([&]() {
+      for (int r = 0; r < rounds; ++r)
+      {
+        for (const ProductHandle& p : products)
+          cars += is_car(p.get()) ? 1 : 0;
+      }
+    });
+    std::cout << name << ": " << ns / (rounds * products.size()) << " ns/check (" << cars / rounds << " cars)"
+              << std::endl;
+  };
+
+  benchmark("dynamic_cast<Car*>", [](Product* p) { return dynamic_cast<Car*>(p) != nullptr; });
+  benchmark("is<Car>", [](Product* p) { return is<Car>(p); });
+}
+
+
+// Registering a factory means constructing it, even if it is never used.
+// With thousands of kinds, that is a lot of work at startup for nothing.
+// LazyFactoryRegistry only records a name and a creator function at 
+// registration; the factory is constructed on its first lookup.
+// Registration must be done before any lookup, but lookups can then 
+// be performed concurrently: construction happens exactly once.
+
+class LazyFactoryRegistry
+{
+public:
+  using Creator = std::unique_ptr<FactoryInterface> (*)();
+
+  void add(std::string_view key, Creator creator)
+  {
+    Entry*& entry = m_index[key];
+    if (!entry) entry = &m_entries.emplace_back();
+    entry->creator = creator;
+  }
+
+  FactoryInterface* find(std::string_view key)
+  {
+    Entry* const* entry = m_index.find(key);
+    if (!entry) return nullptr;
+    Entry& e = **entry;
+    std::call_once(e.once, [&e]() { e.factory = e.creator(); });
+    return e.factory.get();
+  }
+
+  // Throws std::out_of_range if the key is missing.
+  FactoryInterface& at(std::string_view key)
+  {
+    if (FactoryInterface* factory = find(key)) return *factory;
+    throw std::out_of_range("LazyFactoryRegistry::at");
+  }
+
+  // See FlatRegistry::freeze().
+  bool freeze() { return m_index.freeze(); }
+
+  size_t size() const { return m_index.size(); }
+
+private:
+  struct Entry
+  {
+    Creator creator = nullptr;
+    std::once_flag once;
+    std::unique_ptr<FactoryInterface> factory;
+  };
+
+  std::deque<Entry> m_entries; // entries never move, std::once_flag cannot
+  FlatRegistry<Entry*> m_index;
+};
+
+void register_car_factory(LazyFactoryRegistry& factory)
+{
+  factory.add("car", &make_car_factory);
+}
+
+ProductHandle build_car(LazyFactoryRegistry& factory)
+{
+  return factory.at("car").getProduct();
+}
+
+// A factory that does some work when constructed, such as 
+// loading its configuration.
+std::unique_ptr<FactoryInterface> make_configured_car_factory()
+{
+  class ConfiguredCarFactory : public FactoryInterface
+  {
+  public:
+    ConfiguredCarFactory() : m_settings(1024)
+    {
+      for (size_t i = 0; i < m_settings.size(); ++i)
+        m_settings[i] = std::sqrt(static_cast<double>(i));
+    }
+
+    ProductHandle getProduct() override { return make_pooled<Car>(); }
+    ProductBatch getProducts(size_t n) override { return ProductBatch::create<Car>(n); }
+
+  private:
+    std::vector<double> m_settings;
+  };
+
+  return std::make_unique<ConfiguredCarFactory>();
+}
+
+void factory_with_lazy_registration()
+{
+  LazyFactoryRegistry lazy;
+  register_car_factory(lazy);
+  std::cout << is<Car>(build_car(lazy).get()) << std::endl;
+
+  // Startup time with thousands of kinds, only a few of which are used.
+  constexpr int nb_kinds = 10000;
+
+  std::vector<std::string> names;
+  for (int i = 0; i < nb_kinds; ++i)
+    names.push_back("kind" + std::to_string(i));
+
+  FactoryRegistry eager;
+  LazyFactoryRegistry deferred;
+
+  double ms = measure<std::chrono::milliseconds>([&]() {
+    for (const std::string& name : names)
+      eager[name] = make_configured_car_factory();
+    eager.freeze();
+    for (int i = 0; i < 10; ++i)
+      eager.at(names[i])->getProduct();
+  });
+  std::cout << "eager registration: " << ms << " ms" << std::endl;
+
+  ms = measure<std::chrono::milliseconds>([&]() {
+    for (const std::string& name : names)
+      deferred.add(name, &make_configured_car_factory);
+    deferred.freeze();
+    for (int i = 0; i < 10; ++i)
+      deferred.at(names[i]).getProduct();
+  });
+  std::cout << "lazy registration: " << ms << " ms" << std::endl;
+}
+
+
+// To find out which kinds of products dominate creation cost, 
+// instrument() replaces each factory of a FactoryRegistry by a decorator 
+// that records, per kind, the number of products created and the latency 
+// of getProduct() in a FactoryMetrics.
+// Each thread writes to its own set of counters, so the hot path never 
+// contends with other threads; counters are only aggregated when a 
+// snapshot is taken.
+// Live objects are reported by the ObjectPool of each product type 
+// (see track_pool()), since products outlive the call to getProduct(); 
+// the pool derives them from its free lists, so pools that are not 
+// tracked pay nothing.
+
+class FactoryMetrics
+{
+public:
+  static constexpr size_t nb_buckets = 64; // latency histogram, bucket i is [2^(i-1), 2^i) ns
+
+  struct KindStats
+  {
+    std::string kind;
+    std::uint64_t count = 0; // number of products created
+    std::uint64_t calls = 0; // calls to getProduct() or getProducts()
+    std::uint64_t total_ns = 0;
+    std::uint64_t max_ns = 0;
+    std::uint64_t p50_ns = 0; // upper bound of the histogram bucket
+    std::uint64_t p99_ns = 0; // same
+  };
+
+  struct Snapshot
+  {
+    std::vector<KindStats> kinds;
+    std::vector<std::pair<std::string, std::int64_t>> live_objects;
+
+    void write_csv(std::ostream& out) const
+    {
+      out << "kind,count,calls,total_ns,mean_ns,p50_ns,p99_ns,max_ns\n";
+      for (const KindStats& k : kinds)
+      {
+        out << k.kind << ',' << k.count << ',' << k.calls << ',' << k.total_ns << ','
+            << (k.calls ? k.total_ns / k.calls : 0) << ',' << k.p50_ns << ',' << k.p99_ns << ',' << k.max_ns << '\n';
+      }
+      out << "\npool,live\n";
+      for (const auto& gauge : live_objects)
+        out << gauge.first << ',' << gauge.second << '\n';
+    }
+  };
+
+  explicit FactoryMetrics(std::vector<std::string> kinds) : m_id(next_id()), m_kinds(std::move(kinds)) { }
+  FactoryMetrics(const FactoryMetrics&) = delete;
+  FactoryMetrics& operator=(const FactoryMetrics&) = delete;
+
+  const std::vector<std::string>& kinds() const { return m_kinds; }
+
+  void record(size_t kind, std::uint64_t count, std::uint64_t latency_ns)
+  {
+    Counters& c = local_shard().counters[kind];
+    bump(c.count, count);
+    bump(c.calls, 1);
+    bump(c.total_ns, latency_ns);
+    if (latency_ns > c.max_ns.load(std::memory_order_relaxed)) c.max_ns.store(latency_ns, std::memory_order_relaxed);
+    bump(c.histogram[bucket(latency_ns)], 1);
+  }
+
+  // Reports the number of live T in the snapshots.
+  template<typename T>
+  void track_pool(std::string name)
+  {
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    m_pools.emplace_back(std::move(name), &ObjectPool<T>::live);
+  }
+
+  Snapshot snapshot() const
+  {
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    Snapshot result;
+
+    for (size_t k = 0; k < m_kinds.size(); ++k)
+    {
+      KindStats stats;
+      stats.kind = m_kinds[k];
+      std::array<std::uint64_t, nb_buckets> histogram{};
+
+      for (const std::unique_ptr<Shard>& shard : m_shards)
+      {
+        const Counters& c = shard->counters[k];
+        stats.count += c.count.load(std::memory_order_relaxed);
+        stats.calls += c.calls.load(std::memory_order_relaxed);
+        stats.total_ns += c.total_ns.load(std::memory_order_relaxed);
+        stats.max_ns = std::max(stats.max_ns, c.max_ns.load(std::memory_order_relaxed));
+        for (size_t b = 0; b < nb_buckets; ++b)
+          histogram[b] += c.histogram[b].load(std::memory_order_relaxed);
+      }
+
+      stats.p50_ns = percentile(histogram, stats.calls, 0.50);
+      stats.p99_ns = percentile(histogram, stats.calls, 0.99);
+      result.kinds.push_back(std::move(stats));
+    }
+
+    for (const auto& pool : m_pools)
+      result.live_objects.emplace_back(pool.first, pool.second());
+
+    return result;
+  }
+
+private:
+  // Only written by the thread owning the shard, hence the plain 
+  // load + store instead of a read-modify-write.
+  struct Counters
+  {
+    std::atomic<std::uint64_t> count{ 0 };
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> total_ns{ 0 };
+    std::atomic<std::uint64_t> max_ns{ 0 };
+    std::array<std::atomic<std::uint64_t>, nb_buckets> histogram{};
+  };
+
+  struct Shard
+  {
+    explicit Shard(size_t n) : counters(new Counters[n]) { }
+    std::unique_ptr<Counters[]> counters;
+  };
+
+  static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static size_t bucket(std::uint64_t ns)
+  {
+    size_t b = 0;
+    while (ns != 0 && b + 1 < nb_buckets)
+    {
+      ns >>= 1;
+      ++b;
+    }
+    return b;
+  }
+
+  static std::uint64_t percentile(const std::array<std::uint64_t, nb_buckets>& histogram, std::uint64_t total, double p)
+  {
+    const std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(p * total));
+    std::uint64_t seen = 0;
+    for (size_t b = 0; b < nb_buckets; ++b)
+    {
+      seen += histogram[b];
+      if (seen >= rank && seen > 0) return std::uint64_t(1) << b;
+    }
+    return 0;
+  }
+
+  static std::uint64_t next_id()
+  {
+    static std::atomic<std::uint64_t> counter{ 0 };
+    return ++counter;
+  }
+
+  // Each thread remembers its shard of each FactoryMetrics, by id rather 
+  // than by address since an address can be reused by another object.
+  Shard& local_shard()
+  {
+    struct LocalShards
+    {
+      std::uint64_t last_id = 0;
+      Shard* last = nullptr;
+      std::vector<std::pair<std::uint64_t, Shard*>> others;
+    };
+
+    thread_local LocalShards local;
+
+    if (local.last_id == m_id) return *local.last;
+
+    auto it = std::find_if(local.others.begin(), local.others.end(),
+                           [this](const std::pair<std::uint64_t, Shard*>& e) { return e.first == m_id; });
+
+    Shard* shard;
+
+    if (it != local.others.end())
+    {
+      shard = it->second;
+    }
+    else
+    {
+      std::lock_guard<std::mutex> lock{ m_mutex };
+      m_shards.push_back(std::make_unique<Shard>(m_kinds.size()));
+      shard = m_shards.back().get();
+      local.others.emplace_back(m_id, shard);
+    }
+
+    local.last_id = m_id;
+    local.last = shard;
+    return *shard;
+  }
+
+private:
+  std::uint64_t m_id;
+  std::vector<std::string> m_kinds;
+  mutable std::mutex m_mutex;
+  std::vector<std::unique_ptr<Shard>> m_shards; // one per thread that recorded something
+  std::vector<std::pair<std::string, std::function<std::int64_t()>>> m_pools;
+};
+
+class InstrumentedFactory : public FactoryInterface
+{
+public:
+  InstrumentedFactory(std::unique_ptr<FactoryInterface> factory, std::shared_ptr<FactoryMetrics> metrics, size_t kind)
+    : m_factory(std::move(factory)), m_metrics(std::move(metrics)), m_kind(kind)
+  {
+  }
+
+  ProductHandle getProduct() override
+  {
+    auto start = std::chrono::steady_clock::now();
+    ProductHandle product = m_factory->getProduct();
+    m_metrics->record(m_kind, 1, elapsed_ns(start));
+    return product;
+  }
+
+  ProductBatch getProducts(size_t n) override
+  {
+    auto start = std::chrono::steady_clock::now();
+    ProductBatch products = m_factory->getProducts(n);
+    m_metrics->record(m_kind, n, elapsed_ns(start));
+    return products;
+  }
+
+private:
+  static std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+  {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  }
+
+private:
+  std::unique_ptr<FactoryInterface> m_factory;
+  std::shared_ptr<FactoryMetrics> m_metrics;
+  size_t m_kind;
+};
+
+// Wraps all the factories currently in 'registry' in an InstrumentedFactory.
+// Kinds registered afterwards are not instrumented.
+std::shared_ptr<FactoryMetrics> instrument(FactoryRegistry& registry)
+{
+  std::vector<std::string> kinds;
+  for (const FactoryRegistry::Entry& e : registry.entries())
+    kinds.push_back(e.key);
+
+  auto metrics = std::make_shared<FactoryMetrics>(kinds);
+
+  for (size_t i = 0; i < kinds.size(); ++i)
+  {
+    std::unique_ptr<FactoryInterface>& factory = registry.at(kinds[i]);
+    factory = std::make_unique<InstrumentedFactory>(std::move(factory), metrics, i);
+  }
+
+  return metrics;
+}
+
+void factory_with_instrumentation()
+{
+  FactoryRegistry registry;
+  register_car_factory(registry);
+  registry["configured-car"] = make_configured_car_factory();
+
+  std::shared_ptr<FactoryMetrics> metrics = instrument(registry);
+  metrics->track_pool<Car>("Car");
+
+  std::vector<ProductHandle> cars;
+
+  std::thread worker([&registry]() {
+    for (int i = 0; i < 10000; ++i)
+      build_car(registry);
+  });
+
+  for (int i = 0; i < 100; ++i)
+    cars.push_back(build_car(registry));
+  build_many(registry, "configured-car", 50);
+
+  worker.join();
+
+  metrics->snapshot().write_csv(std::cout);
+
+  // A thread that only releases products keeps their blocks in its cache, 
+  // and they are not live anymore.
+  std::atomic<int> stage{ 0 };
+  std::thread consumer([&cars, &stage]() {
+    cars.resize(40);
+    stage = 1;
+    while (stage != 2)
+      std::this_thread::yield();
+  });
+  while (stage != 1)
+    std::this_thread::yield();
+  std::cout << "live cars after release by another thread: " << ObjectPool<Car>::live() << std::endl;
+  stage = 2;
+  consumer.join();
+}
+
+void format_packed_hallows()
+{
+  DeathlyHallows hallows{ false, true, true };
+  PackedHallows packed = hallows;
+  std::ostringstream expected, actual;
+  expected << hallows;
+  actual << packed;
+  std::cout << sizeof(packed) << (expected.str() == actual.str()) << std::endl;
+
+  // Throughput of formatting a million records.
+  constexpr size_t N = 1000000;
+
+  std::vector<DeathlyHallows> records;
+  std::vector<PackedHallows> packed_records;
+  std::mt19937 rng{ 42 };
+  for (size_t i = 0; i < N; ++i)
+  {
+    packed_records.emplace_back(static_cast<std::uint8_t>(rng() & 7));
+    records.push_back(packed_records.back().unpack());
+  }
+
+  auto benchmark = [](const char* name, auto&& run) {
+    size_t bytes = 0;
+    double seconds = measure<std::chrono::seconds>([&]() { bytes = run(); });
+    std::cout << name << ": " << N / seconds / 1e6 << " M records/s, " << bytes / seconds / 1e6 << " MB/s"
+              << std::endl;
+  };
+
+  benchmark("operator<<(DeathlyHallows)", [&records]() {
+    std::ostringstream stream;
+    for (const DeathlyHallows& h : records)
+      stream << h << '\n';
+    return stream.str().size();
+  });
+
+  std::vector<char> buffer(N * (hallows_format::size + 1));
+
+  benchmark("format_lines_to()", [&]() {
+    char* end = hallows_format::format_lines_to(buffer.data(), packed_records.data(),
+                                                packed_records.data() + packed_records.size());
+    return static_cast<size_t>(end - buffer.data());
+  });
+}
+
+
+// Some products are expensive to construct from scratch, but cheap to copy 
+// once configured. For these, a PrototypeFactory holds a fully initialized 
+// prototype and creates products by cloning it into pooled storage.
+
+template<typename T>
+class PrototypeFactory : public FactoryInterface
+{
+public:
+  explicit PrototypeFactory(T prototype) : m_prototype(std::move(prototype)) { }
+
+  const T& prototype() const { return m_prototype; }
+
+  ProductHandle getProduct() override { return make_pooled<T>(m_prototype); }
+  ProductBatch getProducts(size_t n) override { return ProductBatch::create<T>(n, m_prototype); }
+
+private:
+  T m_prototype;
+};
+
+template<typename T>
+void register_prototype(FactoryRegistry& factory, std::string_view kind, T prototype)
+{
+  factory[kind] = std::make_unique<PrototypeFactory<T>>(std::move(prototype));
+}
+
+// A heightmap generated from a sum of waves: computing it costs a lot more 
+// than copying it.
+class Terrain : public TaggedProduct<Terrain>
+{
+public:
+  static constexpr size_t resolution = 32;
+
+  explicit Terrain(unsigned int seed = 0)
+  {
+    std::mt19937 rng{ seed };
+    std::uniform_real_distribution<float> dist{ 0.f, 1.f };
+
+    for (int octave = 0; octave < 16; ++octave)
+    {
+      const float fx = dist(rng) * octave, fy = dist(rng) * octave, amplitude = 1.f / (1 + octave);
+      for (size_t y = 0; y < resolution; ++y)
+      {
+        for (size_t x = 0; x < resolution; ++x)
+          m_heights[y * resolution + x] += amplitude * std::sin(fx * x) * std::cos(fy * y);
+      }
+    }
+  }
+
+  float height(size_t x, size_t y) const { return m_heights[y * resolution + x]; }
+
+private:
+  std::array<float, resolution * resolution> m_heights{};
+};
+
+void factory_with_prototypes()
+{
+  FactoryRegistry registry;
+  register_prototype(registry, "terrain", Terrain{ 7 });
+
+  ProductHandle p = registry.at("terrain")->getProduct();
+  std::cout << (as<Terrain>(p.get())->height(3, 5) == Terrain{ 7 }.height(3, 5)) << std::endl;
+
+  constexpr int N = 2000;
+  float checksum = 0;
+
+  auto benchmark = [&checksum](const char* name, auto&& create) {
+    double seconds = measure<std::chrono::seconds>([&]() {
+      for (int i = 0; i < N; ++i)
+      {
+        ProductHandle terrain = create();
+        checksum += as<Terrain>(terrain.get())->height(1, 1);
+      }
+    });
+    std::cout << name << ": " << N / seconds << " products/s" << std::endl;
+  };
+
+  benchmark("construction", []() { return make_pooled<Terrain>(7u); });
+  benchmark("clone", [&registry]() { return registry.at("terrain")->getProduct(); });
 }